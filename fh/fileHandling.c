@@ -1,7 +1,15 @@
+#define _GNU_SOURCE
 #include "fileHandling.h"
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../er/error.h"
 
+/* What the writer of a shared file gives up before passing it on */
+#define SHARED_FILE_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
 /* Open File return pointer to FILE if success*/
 FILE *openFile(const char *pathname, const char *mode){
         FILE *opened = fopen(pathname, mode);
@@ -20,4 +28,70 @@ void* closeFile(FILE *stream){
         return NULL;
     else
         return (void*) 1;
-}
\ No newline at end of file
+}
+
+/*
+ * Creates a file in memory holding data, sealed so whoever it is passed
+ * to (SCM_RIGHTS) can map it without it changing under them.
+ * Input:
+ *  - data: the contents
+ *  - size: size of data
+ * Returns: the descriptor, or -1 if it couldn't be created
+ */
+int createSharedFile(const char *data, size_t size){
+    int fd = memfd_create("tecnicofs", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    size_t written = 0;
+
+    if (fd < 0)
+        return -1;
+
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, SHARED_FILE_SEALS) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Maps a file in memory passed by someone else, for reading. It must be
+ * sealed against shrinking, so reading the mapping can't fault.
+ * Input:
+ *  - fd: the descriptor
+ *  - size: stores its size
+ * Returns: the mapping, or NULL if it isn't sealed or can't be mapped
+ */
+void *mapSharedFile(int fd, size_t *size){
+    struct stat st;
+    void *map;
+    int seals = fcntl(fd, F_GET_SEALS);
+
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fd, &st) < 0)
+        return NULL;
+
+    *size = st.st_size;
+    /* an empty mapping can't be made, but there is nothing to read */
+    if (*size == 0)
+        return (void*) "";
+
+    map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/*
+ * Unmaps a file mapped with mapSharedFile.
+ */
+void unmapSharedFile(void *map, size_t size){
+    if (size > 0)
+        munmap(map, size);
+}
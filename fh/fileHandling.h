@@ -4,5 +4,8 @@
 
 FILE *openFile(const char *pathname, const char *mode);
 void* closeFile(FILE *stream);
+int createSharedFile(const char *data, size_t size);
+void *mapSharedFile(int fd, size_t *size);
+void unmapSharedFile(void *map, size_t size);
 
 #endif
\ No newline at end of file
@@ -1,47 +1,29 @@
 #include "operations.h"
+#include "path.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fnmatch.h>
 
 #include "../er/error.h"
 #include "../thr/threads.h"
+#include "../sts/stats.h"
+#include "../lg/logging.h"
+#include "../slb/slab.h"
+#include "../wt/watch.h"
 
+/* Release ancestors once a node is locked (hand-over-hand) */
+static int lockCoupling = 0;
 
-/* Given a path, fills pointers with strings for the parent path and child
- * file name
- * Input:
- *  - path: the path to split. ATENTION: the function may alter this parameter
- *  - parent: reference to a char*, to store parent path
- *  - child: reference to a char*, to store child file name
- */
-void split_parent_child_from_path(char * path, char ** parent, char ** child) {
-
-	int n_slashes = 0, last_slash_location = 0;
-	int len = strlen(path);
-
-	// deal with trailing slash ( a/x vs a/x/ )
-	if (path[len-1] == '/') {
-		path[len-1] = '\0';
-	}
-
-	for (int i=0; i < len; ++i) {
-		if (path[i] == '/' && path[i+1] != '\0') {
-			last_slash_location = i;
-			n_slashes++;
-		}
-	}
-
-	if (n_slashes == 0) { // root directory
-		*parent = "";
-		*child = path;
-		return;
-	}
-
-	path[last_slash_location] = '\0';
-	*parent = path;
-	*child = path + last_slash_location + 1;
-
-}
+static int lock_path_node(int inumber, int doLockWrite, int depth, list *List);
+static void lock_entry(int parent_inumber, unsigned int hash, list *List);
+static void unlock_path_node(int inumber, list *List);
+static int check_path_node(parsed_path *path, int component, int parent_inumber, DirEntry *entries, int inumber, unsigned int generation);
+static int lookup_component(parsed_path *path, int component, int inumber, DirEntry *entries);
+static int lookup_path(parsed_path *path, int count, list *List, int doLockWrite, int coupling, int *depth);
+static int lookup_dir_optimistic(parsed_path *path, int count, int *depth, unsigned int *generation, union Data *data);
+static int delete_children(int inumber, int depth, int parallel);
+static int copy_children(int inumber, int copy_inumber, int depth, int parallel);
 
 
 /*
@@ -87,64 +69,64 @@ int is_dir_empty(DirEntry *dirEntries) {
 
 
 /*
- * Looks for node in directory entry from name.
+ * Looks for a component of a path in directory entries, with the hash
+ * computed when the path was parsed.
  * Input:
- *  - name: path of node
+ *  - path: the path
+ *  - component: index of the component
+ *  - inumber: identifier of the directory i-node
  *  - entries: entries of directory
  * Returns:
  *  - inumber: found node's inumber
  *  - FAIL: if not found
  */
-int lookup_sub_node(char *name, DirEntry *entries) {
+static int lookup_component(parsed_path *path, int component, int inumber, DirEntry *entries) {
+	path_component *name = &path->components[component];
+
 	if (entries == NULL) {
 		return FAIL;
 	}
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
-            return entries[i].inumber;
-        }
-    }
-	return FAIL;
+	return dir_find_entry(inumber, entries, path->split + name->offset, name->len, name->hash);
 }
 
 
 /*
- * Creates a new node given a path.
+ * Creates a new node locking the whole path to its parent, for when the
+ * optimistic attempt in create gives up.
  * Input:
- *  - name: path of node
+ *  - path: path of node, with at least one component
  *  - nodeType: type of node
  * Returns: SUCCESS or FAIL
  */
-int create(char *name, type nodeType, list *List){
+static int create_locked(parsed_path *path, type nodeType, list *List){
 
-	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	int parent_inumber, child_inumber, child = path->count - 1;
+	char *name = path->name, *parent_name = path->parent, *child_name = path->child;
 	/* use for copy */
 	type pType;
 	union Data pdata;
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
-
-	parent_inumber = lookup(parent_name, List, 1);
+	/* other names can be created in the same parent meanwhile */
+	parent_inumber = lookup_path(path, child, List, 0, lockCoupling, NULL);
 
 
 	if (parent_inumber == FAIL) {
-		printf("failed to create %s, invalid parent dir %s\n",
+		logMessage(LOG_INFO, "failed to create %s, invalid parent dir %s\n",
 		        name, parent_name);
 		return FAIL;
 	}
 
-	inode_get(parent_inumber, &pType, &pdata);
-
-	if(pType != T_DIRECTORY) {
-		printf("failed to create %s, parent %s is not a dir\n",
+	/* the ancestors may have been released, check the parent is still there */
+	if (inode_get(parent_inumber, &pType, &pdata) == FAIL || pType != T_DIRECTORY) {
+		logMessage(LOG_INFO, "failed to create %s, parent %s is not a dir\n",
 		        name, parent_name);
 		return FAIL;
 	}
 
-	if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
-		printf("failed to create %s, already exists in dir %s\n",
+	lock_entry(parent_inumber, path->components[child].hash, List);
+
+	if (lookup_component(path, child, parent_inumber, pdata.dirEntries) != FAIL) {
+		logMessage(LOG_INFO, "failed to create %s, already exists in dir %s\n",
 		       child_name, parent_name);
 		return FAIL;
 	}
@@ -154,20 +136,107 @@ int create(char *name, type nodeType, list *List){
 	child_inumber = inode_create(nodeType);
 
 	if (child_inumber == FAIL) {
-		printf("failed to create %s in  %s, couldn't allocate inode\n",
+		logMessage(LOG_ERROR, "failed to create %s in  %s, couldn't allocate inode\n",
 		        child_name, parent_name);
 		return FAIL;
 	}
 
-	if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
-		printf("could not add entry %s in dir %s\n",
+	if (dir_add_entry(parent_inumber, child_inumber, child_name, path->components[child].hash) == FAIL) {
+		logMessage(LOG_ERROR, "could not add entry %s in dir %s\n",
 		       child_name, parent_name);
 		return FAIL;
 	}
-	
+
+	watchEvent('c', name, NULL);
 	return SUCCESS;
 }
 
+
+/*
+ * Deletes an i-node created by create that never got an entry, nobody
+ * else can reach it.
+ */
+static void discard_node(int inumber, int depth, list *List) {
+	lock_path_node(inumber, 1, depth, List);
+	inode_delete(inumber);
+}
+
+
+/*
+ * Creates a new node given a path.
+ * The parent is found without locks and the node allocated before locking
+ * anything, then only the parent (for reading) and the entry of the name
+ * are locked to add it, after checking the parent is the same i-node that
+ * was found. If it changed meanwhile this is retried, and after
+ * MAX_CREATE_RETRIES (or when the parent doesn't seem to be there) the
+ * whole path is locked instead.
+ * Input:
+ *  - path: path of node
+ *  - nodeType: type of node
+ * Returns: SUCCESS or FAIL
+ */
+int create(parsed_path *path, type nodeType, list *List){
+
+	int parent_inumber, child_inumber = FAIL, depth = 0, child = path->count - 1;
+	unsigned int generation;
+	char *name = path->name, *parent_name = path->parent, *child_name = path->child;
+	/* use for copy */
+	type pType;
+	union Data pdata;
+
+	if (path->count <= 0) {
+		logMessage(LOG_INFO, "failed to create %s, invalid name\n", name);
+		return FAIL;
+	}
+
+	for (int attempt = 0; attempt < MAX_CREATE_RETRIES; attempt++) {
+		parent_inumber = lookup_dir_optimistic(path, child, &depth, &generation, &pdata);
+
+		/* leave failures for create_locked to confirm */
+		if (parent_inumber == FAIL || lookup_component(path, child, parent_inumber, pdata.dirEntries) != FAIL)
+			break;
+
+		if (child_inumber == FAIL && (child_inumber = inode_create(nodeType)) == FAIL) {
+			logMessage(LOG_ERROR, "failed to create %s in  %s, couldn't allocate inode\n",
+			        child_name, parent_name);
+			return FAIL;
+		}
+
+		lock_path_node(parent_inumber, 0, depth, List);
+
+		/* still the directory that was found, and it can't go away now */
+		if (inode_generation(parent_inumber) == generation) {
+			lock_entry(parent_inumber, path->components[child].hash, List);
+			inode_get(parent_inumber, &pType, &pdata);
+
+			if (lookup_component(path, child, parent_inumber, pdata.dirEntries) != FAIL) {
+				logMessage(LOG_INFO, "failed to create %s, already exists in dir %s\n",
+				       child_name, parent_name);
+				discard_node(child_inumber, depth + 1, List);
+				return FAIL;
+			}
+
+			if (dir_add_entry(parent_inumber, child_inumber, child_name, path->components[child].hash) == FAIL) {
+				logMessage(LOG_ERROR, "could not add entry %s in dir %s\n",
+				       child_name, parent_name);
+				discard_node(child_inumber, depth + 1, List);
+				return FAIL;
+			}
+
+			watchEvent('c', name, NULL);
+			return SUCCESS;
+		}
+
+		unlock_path_node(parent_inumber, List);
+		logMessage(LOG_DEBUG, "create of %s retried, %s changed\n", name, parent_name);
+	}
+
+	if (child_inumber != FAIL)
+		discard_node(child_inumber, depth + 1, List);
+
+	return create_locked(path, nodeType, List);
+}
+
 /*
  * moves a node given a path to another path.
  * Input:
@@ -175,12 +244,13 @@ int create(char *name, type nodeType, list *List){
  * 	- nodeDestination: the final path of the node
  * Returns: SUCCESS or FAIL
  */
-int move(char* nodeOrigin, char* nodeDestination, list *List){
+int move(parsed_path *nodeOrigin, parsed_path *nodeDestination, list *List){
 
 	int parent_inumber_orig, child_inumber_orig;
-	int parent_inumber_dest, child_inumber_dest;
-	char *parent_name_orig, *child_name_orig, name_copy_orig[MAX_FILE_NAME];
-	char *parent_name_dest, *child_name_dest, name_copy_dest[MAX_FILE_NAME];
+	int parent_inumber_dest;
+	char *parent_name_orig = nodeOrigin->parent, *child_name_orig = nodeOrigin->child;
+	char *parent_name_dest = nodeDestination->parent, *child_name_dest = nodeDestination->child;
+	int child_orig = nodeOrigin->count - 1, child_dest = nodeDestination->count - 1;
 
 	type pType_orig, cType_orig;
 	union Data pdata_orig, cdata_orig;
@@ -188,47 +258,52 @@ int move(char* nodeOrigin, char* nodeDestination, list *List){
 	type pType_dest;
 	union Data pdata_dest;
 
-	// Split child from path 
-	strcpy(name_copy_orig, nodeOrigin);
-	split_parent_child_from_path(name_copy_orig, &parent_name_orig, &child_name_orig);
-
-	// Splits Child From Path 
-	strcpy(name_copy_dest, nodeDestination);
-	split_parent_child_from_path(name_copy_dest, &parent_name_dest, &child_name_dest);
-
-	if(strcmp(parent_name_orig, parent_name_dest) < 0){
-		parent_inumber_orig = lookup(parent_name_orig, List, 1);
+	parsed_path *paths[3];
+	int counts[3];
+	int writes[3] = { 1, 1, 1 };
+	int inumbers[3];
 
-		parent_inumber_dest = lookup(parent_name_dest, List, 1);
+	if (nodeOrigin->count <= 0 || nodeDestination->count <= 0) {
+		logMessage(LOG_INFO, "failed to move %s to %s, invalid name\n",
+		        nodeOrigin->name, nodeDestination->name);
+		return FAIL;
 	}
-	else{
-		parent_inumber_dest = lookup(parent_name_dest, List, 1);
 
-		parent_inumber_orig = lookup(parent_name_orig, List, 1);
-	}
-	inode_get(parent_inumber_orig, &pType_orig, &pdata_orig);
-	inode_get(parent_inumber_dest, &pType_dest, &pdata_dest);
-	child_inumber_orig = lookup_sub_node(child_name_orig, pdata_orig.dirEntries);
-	inode_get(child_inumber_orig, &cType_orig, &cdata_orig);
+	/* Lock both parents and the node itself, which is checked for emptiness,
+	 * all at once so two moves never wait on each other. The parent of
+	 * the node is a prefix of its path, walked along with it */
+	paths[0] = nodeOrigin;
+	counts[0] = child_orig;
+	paths[1] = nodeOrigin;
+	counts[1] = nodeOrigin->count;
+	paths[2] = nodeDestination;
+	counts[2] = child_dest;
+	lookup_paths(paths, counts, writes, 3, inumbers, List);
+
+	parent_inumber_orig = inumbers[0];
+	child_inumber_orig = inumbers[1];
+	parent_inumber_dest = inumbers[2];
 
 	/* Invalid Parent Name */
-	if (parent_inumber_dest == FAIL) {
-		printf("failed to move %s, invalid parent dir %s\n",
+	if (parent_inumber_dest == FAIL || inode_get(parent_inumber_dest, &pType_dest, &pdata_dest) == FAIL ||
+	        pType_dest != T_DIRECTORY) {
+		logMessage(LOG_INFO, "failed to move %s, invalid parent dir %s\n",
 		        child_name_dest, parent_name_dest);
 		return FAIL;
 	}
 
 	// Verify if parent is directory 
-	if(pType_orig != T_DIRECTORY) {
-		printf("failed to move %s, parent %s is not a dir\n",
+	if(parent_inumber_orig == FAIL || inode_get(parent_inumber_orig, &pType_orig, &pdata_orig) == FAIL ||
+	        pType_orig != T_DIRECTORY) {
+		logMessage(LOG_INFO, "failed to move %s, parent %s is not a dir\n",
 		        child_name_orig, parent_name_orig);
 		return FAIL;
 	}
 
 
 	// Verify if child origin exists 
-	if (child_inumber_orig == FAIL) {
-		printf("could not move %s, does not exist in dir %s\n",
+	if (child_inumber_orig == FAIL || inode_get(child_inumber_orig, &cType_orig, &cdata_orig) == FAIL) {
+		logMessage(LOG_INFO, "could not move %s, does not exist in dir %s\n",
 		       child_name_orig, parent_name_orig);
 		return FAIL;
 	}
@@ -236,55 +311,51 @@ int move(char* nodeOrigin, char* nodeDestination, list *List){
 
 	//Verify is the one to move if its a dir is empty
 	if (cType_orig == T_DIRECTORY && is_dir_empty(cdata_orig.dirEntries) == FAIL) {
-		printf("could not move %s: is a directory and not empty\n",
-		       name_copy_orig);
-		return FAIL;
-	}
-
-	/* Origin And Destiny name need to be the same */
-	if(strcmp(child_name_orig, child_name_dest)){
-		printf("failed to move %s, invalid destiny path %s\n ",
-			child_name_orig, child_name_dest);
+		logMessage(LOG_INFO, "could not move %s: is a directory and not empty\n",
+		       nodeOrigin->name);
 		return FAIL;
 	}
 
-	/* Destination cant exist */
-	if (lookup_sub_node(child_name_dest, pdata_dest.dirEntries) != FAIL) {
-		printf("failed to move %s, already exists in dir %s\n",
+	/* Can't move a directory into itself */
+	if (child_inumber_orig == parent_inumber_dest) {
+		logMessage(LOG_INFO, "failed to move %s, destiny %s is inside it\n",
 		       child_name_orig, parent_name_dest);
 		return FAIL;
 	}
 
-	/* Delete Node */
-	/* remove entry from folder that contained deleted node */
-	if (dir_reset_entry(parent_inumber_orig, child_inumber_orig) == FAIL) {
-		printf("failed to delete %s from dir %s\n",
-		       child_name_orig, parent_name_orig);
+	/* Origin And Destiny name need to be the same */
+	if(!path_same_components(nodeOrigin, child_orig, nodeDestination, child_dest)){
+		logMessage(LOG_INFO, "failed to move %s, invalid destiny path %s\n ",
+			child_name_orig, child_name_dest);
 		return FAIL;
 	}
 
-	/* Delete node */
-	if (inode_delete(child_inumber_orig) == FAIL) {
-		printf("could not delete inode number %d from dir %s\n",
-		       child_inumber_orig, parent_name_orig);
+	/* Destination cant exist */
+	if (lookup_component(nodeDestination, child_dest, parent_inumber_dest, pdata_dest.dirEntries) != FAIL) {
+		logMessage(LOG_INFO, "failed to move %s, already exists in dir %s\n",
+		       child_name_orig, parent_name_dest);
 		return FAIL;
 	}
 
-	/* Create Node */
-	child_inumber_dest = inode_create(pType_orig);
-	if (child_inumber_dest == FAIL) {
-		printf("failed to create %s in  %s, couldn't allocate inode\n",
-		        child_name_dest, parent_name_dest);
+	/* The node keeps its i-node, with its contents and metadata, and is
+	 * only linked into one parent and then unlinked from the other, so
+	 * a destination that is full leaves it where it was */
+	if (dir_add_entry(parent_inumber_dest, child_inumber_orig, child_name_dest,
+	        nodeDestination->components[child_dest].hash) == FAIL) {
+		logMessage(LOG_ERROR, "could not add entry %s in dir %s\n",
+		       child_name_dest, parent_name_dest);
 		return FAIL;
 	}
 
-	/* Add Entry */
-	if (dir_add_entry(parent_inumber_dest, child_inumber_dest, child_name_dest) == FAIL) {
-		printf("could not add entry %s in dir %s\n",
-		       child_name_dest, parent_name_dest);
+	if (dir_reset_entry(parent_inumber_orig, child_inumber_orig) == FAIL) {
+		logMessage(LOG_ERROR, "failed to delete %s from dir %s\n",
+		       child_name_orig, parent_name_orig);
+		dir_reset_entry(parent_inumber_dest, child_inumber_orig);
 		return FAIL;
 	}
+	inode_moved(child_inumber_orig);
 
+	watchEvent('m', nodeOrigin->name, nodeDestination->name);
 	return SUCCESS;
 
 }
@@ -293,133 +364,934 @@ int move(char* nodeOrigin, char* nodeDestination, list *List){
 /*
  * Deletes a node given a path.
  * Input:
- *  - name: path of node
+ *  - path: path of node
+ *  - recursive: delete everything under a directory first, instead of
+ *    refusing one that is not empty
  * Returns: SUCCESS or FAIL
  */
-int delete(char *name, list *List){
+int delete(parsed_path *path, int recursive, list *List){
 
-	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	int parent_inumber, child_inumber, depth, child = path->count - 1;
+	char *name = path->name, *parent_name = path->parent, *child_name = path->child;
 	/* use for copy */
 	type pType, cType;
 	union Data pdata, cdata;
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
-
+	if (path->count <= 0) {
+		logMessage(LOG_INFO, "failed to delete %s, invalid name\n", name);
+		return FAIL;
+	}
 
-	parent_inumber = lookup(parent_name, List, 1);
+	/* other names can be deleted from the same parent meanwhile */
+	parent_inumber = lookup_path(path, child, List, 0, lockCoupling, &depth);
 
 	if (parent_inumber == FAIL) {
-		printf("failed to delete %s, invalid parent dir %s\n",
+		logMessage(LOG_INFO, "failed to delete %s, invalid parent dir %s\n",
 		        child_name, parent_name);
 		return FAIL;
 	}
 
-	inode_get(parent_inumber, &pType, &pdata);
-
-	if(pType != T_DIRECTORY) {
-		printf("failed to delete %s, parent %s is not a dir\n",
+	/* the ancestors may have been released, check the parent is still there */
+	if (inode_get(parent_inumber, &pType, &pdata) == FAIL || pType != T_DIRECTORY) {
+		logMessage(LOG_INFO, "failed to delete %s, parent %s is not a dir\n",
 		        child_name, parent_name);
 		return FAIL;
 	}
 
-	child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
+	lock_entry(parent_inumber, path->components[child].hash, List);
+
+	child_inumber = lookup_component(path, child, parent_inumber, pdata.dirEntries);
 
 	if (child_inumber == FAIL) {
-		printf("could not delete %s, does not exist in dir %s\n",
+		logMessage(LOG_INFO, "could not delete %s, does not exist in dir %s\n",
 		       name, parent_name);
 		return FAIL;
 	}
 
+	/* nobody can be adding entries to it while we check it is empty */
+	lock_path_node(child_inumber, 1, depth + 1, List);
 	inode_get(child_inumber, &cType, &cdata);
 
 	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
-		printf("could not delete %s: is a directory and not empty\n",
-		       name);
-		return FAIL;
+		if (!recursive) {
+			logMessage(LOG_INFO, "could not delete %s: is a directory and not empty\n",
+			       name);
+			return FAIL;
+		}
+
+		if (delete_children(child_inumber, depth + 1, 1) == FAIL) {
+			logMessage(LOG_ERROR, "failed to delete everything under %s\n", name);
+			return FAIL;
+		}
 	}
 
 	/* remove entry from folder that contained deleted node */
 	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
-		printf("failed to delete %s from dir %s\n",
+		logMessage(LOG_ERROR, "failed to delete %s from dir %s\n",
 		       child_name, parent_name);
 		return FAIL;
 	}
 
 	if (inode_delete(child_inumber) == FAIL) {
-		printf("could not delete inode number %d from dir %s\n",
+		logMessage(LOG_ERROR, "could not delete inode number %d from dir %s\n",
 		       child_inumber, parent_name);
 		return FAIL;
 	}
 
+	watchEvent('d', name, NULL);
 	return SUCCESS;
 }
 
 
 /*
- * Lookup for a given path.
+ * Copies a node and everything under it given a path. The source (for
+ * reading) and the parent of the copy are locked once, the copy is built where nobody can
+ * see it yet and added to its parent at the end, so it shows up whole.
  * Input:
- *  - name: path of node
+ *  - origin: path of the node to copy
+ *  - destination: path of the copy, can't be under the node
+ * Returns: SUCCESS or FAIL
+ */
+int copy(parsed_path *origin, parsed_path *destination, list *List){
+
+	int inumber_orig, parent_inumber_dest, copy_inumber;
+	int depth = origin->count, child_dest = destination->count - 1, under;
+	char *nodeOrigin = origin->name, *nodeDestination = destination->name;
+	char *parent_name_dest = destination->parent, *child_name_dest = destination->child;
+
+	/* use for copy */
+	type nType;
+	union Data data, pdata_dest;
+
+	/* the source is only read, the parent of the copy is written */
+	parsed_path *paths[2];
+	int counts[2];
+	int writes[2] = { 0, 1 };
+	int inumbers[2];
+
+	if (origin->count == FAIL || destination->count <= 0) {
+		logMessage(LOG_INFO, "failed to copy %s to %s, invalid name\n", nodeOrigin, nodeDestination);
+		return FAIL;
+	}
+
+	under = destination->count >= origin->count;
+	for (int i = 0; under && i < origin->count; i++)
+		under = path_same_components(origin, i, destination, i);
+
+	if (under) {
+		logMessage(LOG_INFO, "failed to copy %s, %s is under it\n", nodeOrigin, nodeDestination);
+		return FAIL;
+	}
+
+	paths[0] = origin;
+	counts[0] = origin->count;
+	paths[1] = destination;
+	counts[1] = child_dest;
+	lookup_paths(paths, counts, writes, 2, inumbers, List);
+	inumber_orig = inumbers[0];
+	parent_inumber_dest = inumbers[1];
+
+	if (inumber_orig == FAIL || inode_get(inumber_orig, &nType, &data) == FAIL) {
+		logMessage(LOG_INFO, "failed to copy %s, does not exist\n", nodeOrigin);
+		return FAIL;
+	}
+
+	if (parent_inumber_dest == FAIL || inode_get(parent_inumber_dest, &nType, &pdata_dest) == FAIL ||
+	        nType != T_DIRECTORY) {
+		logMessage(LOG_INFO, "failed to copy %s, invalid parent dir %s\n",
+		        nodeOrigin, parent_name_dest);
+		return FAIL;
+	}
+
+	if (lookup_component(destination, child_dest, parent_inumber_dest, pdata_dest.dirEntries) != FAIL) {
+		logMessage(LOG_INFO, "failed to copy %s, %s already exists\n", nodeOrigin, nodeDestination);
+		return FAIL;
+	}
+
+	inode_get(inumber_orig, &nType, &data);
+	copy_inumber = inode_create(nType);
+
+	if (copy_inumber == FAIL) {
+		logMessage(LOG_ERROR, "failed to copy %s, couldn't allocate inode\n", nodeOrigin);
+		return FAIL;
+	}
+
+	if ((nType == T_FILE && data.fileContents != NULL &&
+	        inode_set_file(copy_inumber, data.fileContents, inode_get_file(inumber_orig, NULL)) == FAIL) ||
+	        (nType == T_DIRECTORY && copy_children(inumber_orig, copy_inumber, depth + 1, 1) == FAIL) ||
+	        dir_add_entry(parent_inumber_dest, copy_inumber, child_name_dest,
+	                destination->components[child_dest].hash) == FAIL) {
+		logMessage(LOG_ERROR, "failed to copy %s to %s\n", nodeOrigin, nodeDestination);
+		delete_children(copy_inumber, depth + 1, 0);
+		inode_delete(copy_inumber);
+		return FAIL;
+	}
+
+	watchEvent('c', nodeDestination, NULL);
+	return SUCCESS;
+}
+
+
+/*
+ * Work on the children of a directory in a recursive delete or copy, a
+ * thread does every step-th child starting at first.
+ */
+typedef struct subtree_job {
+	int (*work)(int parent, int inumber, int depth);
+	int parent;
+	int *inumbers;
+	int *results;
+	int count;
+	int first;
+	int step;
+	int depth;
+	int started;
+	pthread_t thread;
+} subtree_job;
+
+static void run_subtree_job(subtree_job *job) {
+	for (int i = job->first; i < job->count; i += job->step)
+		job->results[i] = job->work(job->parent, job->inumbers[i], job->depth);
+}
+
+static void *subtree_helper(void *arg) {
+	run_subtree_job(arg);
+
+	slabThreadFlush();
+	logThreadExit();
+
+	return NULL;
+}
+
+
+/*
+ * Runs work on each child, split between up to SUBTREE_MAX_THREADS
+ * threads (this one included) when parallel.
+ * Input:
+ *  - work: what to do with each child, given the parent, its inumber and depth
+ *  - parent: identifier of the directory, locked
+ *  - inumbers: the children
+ *  - results: stores what work returned for each child
+ *  - count: number of children
+ *  - depth: level of the children
+ *  - parallel: use helper threads
+ */
+static void for_each_child(int (*work)(int, int, int), int parent, int *inumbers, int *results, int count, int depth, int parallel) {
+	subtree_job jobs[SUBTREE_MAX_THREADS];
+	int threads = parallel ? count : 1;
+
+	if (threads > SUBTREE_MAX_THREADS)
+		threads = SUBTREE_MAX_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	for (int t = 0; t < threads; t++) {
+		jobs[t] = (subtree_job) { work, parent, inumbers, results, count, t, threads, depth, 0 };
+
+		if (t > 0)
+			jobs[t].started = pthread_create(&jobs[t].thread, NULL, subtree_helper, &jobs[t]) == 0;
+	}
+
+	/* the jobs that didn't get a thread are done by this one */
+	for (int t = 0; t < threads; t++) {
+		if (!jobs[t].started)
+			run_subtree_job(&jobs[t]);
+	}
+
+	for (int t = 1; t < threads; t++) {
+		if (jobs[t].started && pthread_join(jobs[t].thread, NULL))
+			errorParse("Error while joining a subtree helper thread\n");
+	}
+}
+
+
+/*
+ * Locks a node under a locked directory, timing the wait like lock_path_node.
+ * The caller unlocks it.
+ */
+static void lock_subtree_node(int inumber, int doLockWrite, int depth) {
+	long long waitStart = statsNow();
+
+	if (doLockWrite)
+		lockInumberWrite(inumber, depth);
+	else
+		lockInumberRead(inumber, depth);
+	statsRecordLockWait(depth, statsNow() - waitStart);
+}
+
+
+/*
+ * Lists the children of a directory.
+ * Input:
+ *  - inumber: identifier of the directory, locked
+ *  - children: stores the inumbers, at least MAX_DIR_ENTRIES
+ *  - names: if not NULL, stores the names, at least MAX_DIR_ENTRIES
+ * Returns: number of children
+ */
+static int list_children(int inumber, int *children, char names[][MAX_FILE_NAME]) {
+	char name[MAX_FILE_NAME];
+	int count = 0;
+	type nType;
+	union Data data;
+
+	if (inode_get(inumber, &nType, &data) == FAIL || nType != T_DIRECTORY)
+		return 0;
+
+	for (int slot = 0; slot < MAX_DIR_ENTRIES; slot++) {
+		int child = dir_read_entry(data.dirEntries, slot, name);
+
+		if (child == FAIL)
+			continue;
+		if (names)
+			strcpy(names[count], name);
+		children[count++] = child;
+	}
+	return count;
+}
+
+
+/*
+ * Deletes a node and everything under it, its parent is locked for
+ * writing. The node is only deleted while locked, so a create that was
+ * waiting for it sees it is gone.
+ */
+static int delete_subtree(int parent, int inumber, int depth) {
+	int result;
+
+	lock_subtree_node(inumber, 1, depth);
+
+	result = delete_children(inumber, depth + 1, 0);
+	if (result == SUCCESS && (dir_reset_entry(parent, inumber) == FAIL || inode_delete(inumber) == FAIL))
+		result = FAIL;
+
+	unlockInumberRW(inumber);
+	return result;
+}
+
+
+/*
+ * Deletes everything under a directory.
+ * Input:
+ *  - inumber: identifier of the directory, locked for writing
+ *  - depth: level of its children
+ *  - parallel: split the children between helper threads
+ * Returns: SUCCESS or FAIL
+ */
+static int delete_children(int inumber, int depth, int parallel) {
+	int children[MAX_DIR_ENTRIES], results[MAX_DIR_ENTRIES];
+	int count = list_children(inumber, children, NULL);
+	int result = SUCCESS;
+
+	for_each_child(delete_subtree, inumber, children, results, count, depth, parallel);
+
+	for (int i = 0; i < count; i++) {
+		if (results[i] == FAIL)
+			result = FAIL;
+	}
+	return result;
+}
+
+
+/*
+ * Copies a node and everything under it, its parent is locked.
+ * Returns: the inumber of the copy, or FAIL
+ */
+static int copy_subtree(int parent, int inumber, int depth) {
+	int copy_inumber;
+	type nType;
+	union Data data;
+
+	lock_subtree_node(inumber, 0, depth);
+	inode_get(inumber, &nType, &data);
+
+	copy_inumber = inode_create(nType);
+	if (copy_inumber != FAIL && ((nType == T_FILE && data.fileContents != NULL &&
+	        inode_set_file(copy_inumber, data.fileContents, inode_get_file(inumber, NULL)) == FAIL) ||
+	        (nType == T_DIRECTORY && copy_children(inumber, copy_inumber, depth + 1, 0) == FAIL))) {
+		delete_children(copy_inumber, depth + 1, 0);
+		inode_delete(copy_inumber);
+		copy_inumber = FAIL;
+	}
+
+	unlockInumberRW(inumber);
+	return copy_inumber;
+}
+
+
+/*
+ * Copies everything under a directory into another one nobody else can see.
+ * Input:
+ *  - inumber: identifier of the directory, locked
+ *  - copy_inumber: identifier of the empty directory to copy into
+ *  - depth: level of the children
+ *  - parallel: split the children between helper threads
+ * Returns: SUCCESS or FAIL, leaving what was copied in copy_inumber
+ */
+static int copy_children(int inumber, int copy_inumber, int depth, int parallel) {
+	int children[MAX_DIR_ENTRIES], results[MAX_DIR_ENTRIES];
+	char names[MAX_DIR_ENTRIES][MAX_FILE_NAME];
+	int count = list_children(inumber, children, names);
+	int result = SUCCESS;
+
+	for_each_child(copy_subtree, inumber, children, results, count, depth, parallel);
+
+	for (int i = 0; i < count; i++) {
+		if (results[i] == FAIL) {
+			result = FAIL;
+		} else if (dir_add_entry(copy_inumber, results[i], names[i], dir_name_hash(names[i], strlen(names[i]))) == FAIL) {
+			delete_children(results[i], depth + 1, 0);
+			inode_delete(results[i]);
+			result = FAIL;
+		}
+	}
+	return result;
+}
+
+
+/*
+ * Locks a node found while walking a path, unless this thread already holds it.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - doLockWrite: lock for writing instead of reading
+ *  - depth: level of the i-node in the tree, for the lock wait statistics
+ *  - List: locks held by this thread
+ * Returns: 1 if the lock was taken now, 0 if it was already held
+ */
+static int lock_path_node(int inumber, int doLockWrite, int depth, list *List) {
+	long long waitStart;
+
+	if (searchList(getLockInumber(inumber), List))
+		return 0;
+
+	waitStart = statsNow();
+	if (doLockWrite)
+		lockInumberWrite(inumber, depth);
+	else
+		lockInumberRead(inumber, depth);
+	statsRecordLockWait(depth, statsNow() - waitStart);
+
+	addList(List, getLockInumber(inumber));
+	return 1;
+}
+
+
+/*
+ * Checks a node found in a directory before it was locked is still the
+ * one there, now that it is locked: the directory is only read locked, so
+ * the node may have been deleted meanwhile, and its i-node even created
+ * again somewhere else. Expected under load, so it isn't logged.
+ * Input:
+ *  - path: path of node
+ *  - component: index of the component the node was found by
+ *  - parent_inumber: identifier of the directory, still locked
+ *  - entries: entries of the directory
+ *  - inumber: identifier of the i-node, locked
+ *  - generation: its generation before it was locked
+ * Returns: SUCCESS or FAIL
+ */
+static int check_path_node(parsed_path *path, int component, int parent_inumber, DirEntry *entries, int inumber, unsigned int generation) {
+	if (inode_generation(inumber) != generation)
+		return FAIL;
+
+	/* deleted before the generation was read, the entry is cleared first */
+	if (lookup_component(path, component, parent_inumber, entries) != inumber)
+		return FAIL;
+
+	return SUCCESS;
+}
+
+
+/*
+ * Locks a name in a directory for writing, the directory itself must be
+ * locked. Commands holding it are the only ones adding or removing the name.
+ * Input:
+ *  - parent_inumber: identifier of the directory i-node
+ *  - hash: hash of the name
+ *  - List: locks held by this thread
+ */
+static void lock_entry(int parent_inumber, unsigned int hash, list *List) {
+	pthread_rwlock_t *entryLock = getEntryLock(parent_inumber, hash);
+
+	lockWriteRW(entryLock);
+	addList(List, entryLock);
+}
+
+
+/*
+ * Releases a node locked by lock_path_node before the command ends.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - List: locks held by this thread
+ */
+static void unlock_path_node(int inumber, list *List) {
+	deleteList(List, getLockInumber(inumber));
+	unlockInumberItem(getLockInumber(inumber));
+}
+
+
+/*
+ * Walks a path, or the path of one of its ancestors, locking each node on
+ * the way.
+ * Input:
+ *  - path: path of node
+ *  - count: number of components to walk, path->count for the node itself
+ *  - List: locks held by this thread
+ *  - doLockWrite: lock the last node for writing
+ *  - coupling: release each node once its child is locked, keeping
+ *    only the last one (nodes held before the walk are kept)
+ *  - depth: if not NULL, stores the level of the last node found
  * Returns:
  *  inumber: identifier of the i-node, if found
  *     FAIL: otherwise
  */
-int lookup(char *name, list* List, int doLockWrite) {
-	char full_path[MAX_FILE_NAME];
-	char test_path[MAX_FILE_NAME];
+static int lookup_path(parsed_path *path, int count, list *List, int doLockWrite, int coupling, int *depth) {
+	/* start at root node */
+	int current_inumber = FS_ROOT;
+	int parent_inumber, parent_locked;
+	int level = 0;
+
+	/* use for copy */
+	type nType;
+	union Data data;
 
-	char delim[] = "/";
-	char *parent_name, *child_name, *saveptr;
+	if (depth)
+		*depth = 0;
+	/* too long to be there */
+	if (path->count == FAIL)
+		return FAIL;
+
+	/* Lock Root */
+	parent_inumber = current_inumber;
+	parent_locked = lock_path_node(current_inumber, count == 0 && doLockWrite, level, List);
 
-	strcpy(full_path, name);
-	strcpy(test_path, name);
-	split_parent_child_from_path(test_path, &parent_name, &child_name);
+	/* get root inode data */
+	inode_get(current_inumber, &nType, &data);
 
+	/* search for all sub nodes */
+	while (level < count && (current_inumber = lookup_component(path, level, parent_inumber, data.dirEntries)) != FAIL) {
+		unsigned int generation = inode_generation(current_inumber);
 
+		level++;
+
+		/* Lock node, then its parent is no longer needed */
+		int locked = lock_path_node(current_inumber, level == count && doLockWrite, level, List);
+		int found = check_path_node(path, level - 1, parent_inumber, data.dirEntries, current_inumber, generation);
+
+		if (coupling && parent_locked)
+			unlock_path_node(parent_inumber, List);
+
+		parent_inumber = current_inumber;
+		parent_locked = locked;
+
+		if (found == FAIL) {
+			current_inumber = FAIL;
+			break;
+		}
+		inode_get(current_inumber, &nType, &data);
+	}
+
+	if (depth)
+		*depth = level;
+
+	return current_inumber;
+}
+
+
+/*
+ * Walks a path to a directory without taking any lock. What it finds may
+ * be stale: callers lock the directory and compare its generation.
+ * Input:
+ *  - path: path of node
+ *  - count: number of components to walk, as in lookup_path
+ *  - depth: stores the level of the directory
+ *  - generation: stores the generation of the directory
+ *  - data: stores the data of the directory
+ * Returns:
+ *  inumber: identifier of the directory, if found
+ *     FAIL: otherwise, or if it is not a directory
+ */
+static int lookup_dir_optimistic(parsed_path *path, int count, int *depth, unsigned int *generation, union Data *data) {
 	/* start at root node */
 	int current_inumber = FS_ROOT;
+	type nType;
+
+	*depth = 0;
+
+	if (path->count == FAIL || inode_peek(current_inumber, &nType, data, generation) == FAIL)
+		return FAIL;
+
+	for (int i = 0; i < count; i++) {
+		if (nType != T_DIRECTORY)
+			return FAIL;
+
+		current_inumber = lookup_component(path, i, current_inumber, data->dirEntries);
+		if (current_inumber == FAIL || inode_peek(current_inumber, &nType, data, generation) == FAIL)
+			return FAIL;
+
+		(*depth)++;
+	}
+
+	return nType == T_DIRECTORY ? current_inumber : FAIL;
+}
+
+
+/*
+ * Walks several paths at once, locking every node on them in a single
+ * global order: by depth, and by inumber within the same depth. Every other
+ * command locks strictly downwards, and an i-node only changes depth when
+ * it is moved, locked for writing along with both its parents, so nobody
+ * holds it then: commands that lock several paths can't deadlock with each
+ * other nor with single path ones.
+ * A node shared by several paths is locked once, for writing if it is the
+ * last node of any of them that asks for it.
+ * Input:
+ *  - paths: the paths, at most MAX_LOCK_PATHS
+ *  - counts: number of components to walk of each path, as in lookup_path
+ *  - writes: whether the last node of each path is locked for writing
+ *    instead of reading (the nodes above it are always read locked)
+ *  - count: number of paths
+ *  - inumbers: stores the last node of each path, or FAIL if not found
+ *  - List: locks held by this thread
+ */
+void lookup_paths(parsed_path *paths[], int counts[], int writes[], int count, int inumbers[], list *List) {
+	int lengths[MAX_LOCK_PATHS];
+	int next[MAX_LOCK_PATHS];
+	unsigned int generations[MAX_LOCK_PATHS];
+	DirEntry *entries[MAX_LOCK_PATHS];
+	int max_length = 0;
+	int root_write = 0;
 
 	/* use for copy */
 	type nType;
 	union Data data;
 
-	/* Lock Root */
-	if(!searchList(getLockInumber(current_inumber), List)){
-		if(!strcmp(child_name, "") && doLockWrite){
-			lockInumberWrite(current_inumber);
-			addList(List, getLockInumber(current_inumber));
-		}
-		else{
-			lockInumberRead(current_inumber);
-			addList(List, getLockInumber(current_inumber));
-		}
+	for (int i = 0; i < count; i++) {
+		inumbers[i] = FS_ROOT;
+
+		lengths[i] = counts[i];
+		if (paths[i]->count == FAIL) {
+			/* too long to be there */
+			lengths[i] = 0;
+			inumbers[i] = FAIL;
+		} else if (lengths[i] == 0 && writes[i])
+			root_write = 1;
+
+		if (lengths[i] > max_length)
+			max_length = lengths[i];
 	}
 
-	/* get root inode data */
-	inode_get(current_inumber, &nType, &data);
+	lock_path_node(FS_ROOT, root_write, 0, List);
 
-	char *path = strtok_r(full_path, delim, &saveptr);
+	for (int depth = 1; depth <= max_length; depth++) {
+		/* find the nodes at this depth, their parents are locked */
+		for (int i = 0; i < count; i++) {
+			next[i] = FAIL;
+			if (depth > lengths[i] || inumbers[i] == FAIL)
+				continue;
 
-	/* search for all sub nodes */
-	while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
-		/* Lock node */
-		if(!searchList(getLockInumber(current_inumber), List)){
-			if(!strcmp(child_name, path) && doLockWrite){
-				lockInumberWrite(current_inumber);
-				addList(List, getLockInumber(current_inumber));
+			if (inode_get(inumbers[i], &nType, &data) == SUCCESS && nType == T_DIRECTORY) {
+				entries[i] = data.dirEntries;
+				next[i] = lookup_component(paths[i], depth - 1, inumbers[i], entries[i]);
+				if (next[i] != FAIL)
+					generations[i] = inode_generation(next[i]);
+			}
+		}
+
+		/* lock them by increasing inumber */
+		for (int locked = FAIL; ; ) {
+			int lowest = FAIL, doLockWrite = 0;
+
+			for (int i = 0; i < count; i++) {
+				if (next[i] != FAIL && next[i] > locked && (lowest == FAIL || next[i] < lowest))
+					lowest = next[i];
 			}
-			else{
-				lockInumberRead(current_inumber);
-				addList(List, getLockInumber(current_inumber));
+			if (lowest == FAIL)
+				break;
+
+			for (int i = 0; i < count; i++) {
+				if (next[i] == lowest && depth == lengths[i] && writes[i])
+					doLockWrite = 1;
 			}
+			lock_path_node(lowest, doLockWrite, depth, List);
+			locked = lowest;
 		}
 
-		inode_get(current_inumber, &nType, &data);
-		path = strtok_r(NULL, delim, &saveptr);
+		for (int i = 0; i < count; i++) {
+			if (next[i] != FAIL && check_path_node(paths[i], depth - 1, inumbers[i], entries[i], next[i], generations[i]) == FAIL)
+				next[i] = FAIL;
+			if (depth <= lengths[i])
+				inumbers[i] = next[i];
+		}
+	}
+}
+
+
+/*
+ * Lists a page of the entries of a directory, holding only shared locks
+ * on its path. Entries are read in the order of their slots, so the ones
+ * there during the whole listing are listed exactly once, while the ones
+ * added or removed meanwhile may or may not be.
+ * Input:
+ *  - path: path of the directory
+ *  - cursor: 0 for the first page or the one given by the previous page,
+ *    stores the cursor of the next page (0 after the last one)
+ *  - names: stores the names, each ending with '\0'
+ *  - size: size of names, stores the bytes used
+ *  - List: locks held by this thread
+ * Returns:
+ *  number of names: if listed
+ *              FAIL: if not a directory, or the cursor is of a directory
+ *                    deleted since
+ */
+int read_dir(parsed_path *path, int *cursor, char *names, int *size, list *List) {
+	char entry_name[MAX_FILE_NAME];
+	int inumber, slot, generation, len;
+	int count = 0, used = 0;
+
+	/* use for copy */
+	type nType;
+	union Data data;
+
+	inumber = lookup(path, List, 0);
+	if (inumber == FAIL || inode_get(inumber, &nType, &data) == FAIL || nType != T_DIRECTORY)
+		return FAIL;
+
+	generation = inode_generation(inumber) & READDIR_GENERATION_MASK;
+	slot = *cursor & ((1 << READDIR_SLOT_BITS) - 1);
+
+	if (*cursor != 0 && ((*cursor >> READDIR_SLOT_BITS) != generation || slot >= MAX_DIR_ENTRIES))
+		return FAIL;
+
+	for (; slot < MAX_DIR_ENTRIES; slot++) {
+		if (dir_read_entry(data.dirEntries, slot, entry_name) == FAIL)
+			continue;
+
+		len = strlen(entry_name) + 1;
+		if (used + len > *size)
+			break;
+
+		memcpy(names + used, entry_name, len);
+		used += len;
+		count++;
 	}
 
-	return current_inumber;
+	*cursor = slot < MAX_DIR_ENTRIES ? (generation << READDIR_SLOT_BITS) | slot : 0;
+	*size = used;
+
+	return count;
+}
+
+
+/*
+ * Gets the metadata of a node, holding only shared locks on its path.
+ * Input:
+ *  - path: path of node
+ *  - st: stores the metadata
+ *  - List: locks held by this thread
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int stat_node(parsed_path *path, node_stat *st, list *List) {
+	int inumber = lookup(path, List, 0);
+
+	if (inumber == FAIL || inode_stat(inumber, st) == FAIL)
+		return FAIL;
+
+	return inumber;
+}
+
+
+/*
+ * Reads the contents of a file, holding only shared locks on its path.
+ * Input:
+ *  - path: path of the file
+ *  - reader: called with the contents (NULL if it has none) and their
+ *    size while the file is locked, returns what read_file returns
+ *  - arg: passed to reader
+ *  - List: locks held by this thread
+ * Returns: what reader returned, or FAIL if it isn't a file
+ */
+int read_file(parsed_path *path, int (*reader)(char *contents, int size, void *arg), void *arg, list *List) {
+	int inumber = lookup(path, List, 0);
+	char *contents;
+	int size;
+
+	if (inumber == FAIL || (size = inode_get_file(inumber, &contents)) == FAIL)
+		return FAIL;
+
+	return reader(contents, size, arg);
+}
+
+
+/*
+ * Replaces the contents of a file.
+ * Input:
+ *  - path: path of the file
+ *  - contents: the new contents
+ *  - size: size of contents, smaller than FILE_MAX_SIZE
+ *  - List: locks held by this thread
+ * Returns: SUCCESS or FAIL
+ */
+int write_file(parsed_path *path, char *contents, int size, list *List) {
+	int inumber = lookup(path, List, 1);
+
+	if (inumber == FAIL || inode_get_file(inumber, NULL) == FAIL ||
+	        inode_set_file(inumber, contents, size) == FAIL)
+		return FAIL;
+
+	watchEvent('u', path->name, NULL);
+	return SUCCESS;
+}
+
+
+/*
+ * A find being walked, see find
+ */
+typedef struct find_walk {
+	char *components[MAX_FILE_NAME / 2 + 1];
+	int count;
+	type nType;
+	int (*found)(char *path, void *arg);
+	void *arg;
+	int matches;
+	int stopped;
+} find_walk;
+
+
+/* Reports a match, unless the caller asked to stop */
+static void find_report(find_walk *walk, char *path, type nType) {
+	if (walk->stopped || (walk->nType != T_NONE && walk->nType != nType))
+		return;
+
+	walk->matches++;
+	if (walk->found(path, walk->arg) == FAIL)
+		walk->stopped = 1;
+}
+
+
+/*
+ * Matches the children of a directory against a component of the
+ * pattern, going only into the directories that can still match.
+ * Input:
+ *  - walk: the find
+ *  - inumber: identifier of the directory, locked for reading
+ *  - path: path of the directory
+ *  - component: index of the component the children are matched against
+ *  - depth: level of the directory
+ */
+static void find_in_dir(find_walk *walk, int inumber, char *path, int component, int depth) {
+	int children[MAX_DIR_ENTRIES];
+	char names[MAX_DIR_ENTRIES][MAX_FILE_NAME];
+	char child_path[MAX_FILE_NAME];
+	char *pattern = walk->components[component];
+	int last = component == walk->count - 1;
+	int any_depth = strcmp(pattern, "**") == 0;
+	int count;
+
+	/* ** also matches no directory at all */
+	if (any_depth && !last)
+		find_in_dir(walk, inumber, path, component + 1, depth);
+
+	count = list_children(inumber, children, names);
+
+	for (int i = 0; i < count && !walk->stopped; i++) {
+		unsigned int generation;
+		type nType;
+		union Data data;
+
+		if (!any_depth && fnmatch(pattern, names[i], FNM_PERIOD) != 0)
+			continue;
+		if (inode_peek(children[i], &nType, &data, &generation) == FAIL)
+			continue;
+		if (snprintf(child_path, sizeof(child_path), "%s/%s", path, names[i]) >= sizeof(child_path))
+			continue;
+
+		if (last)
+			find_report(walk, child_path, nType);
+		if (nType != T_DIRECTORY || (last && !any_depth))
+			continue;
+
+		lock_subtree_node(children[i], 0, depth + 1);
+		/* it may have been deleted, and its inumber reused, since it was listed */
+		if (inode_generation(children[i]) == generation)
+			find_in_dir(walk, children[i], child_path, any_depth ? component : component + 1, depth + 1);
+		unlockInumberRW(children[i]);
+	}
+}
+
+
+/*
+ * Finds the nodes under a directory whose path, from the directory, matches
+ * a pattern. Each component of the pattern is a glob (see fnmatch) matched
+ * against one level, or ** for any number of levels, so only directories
+ * that can still match are walked, each locked for reading while its
+ * children are matched.
+ * Input:
+ *  - path: path of the directory
+ *  - pattern: the pattern, everything under the directory if empty
+ *  - nType: only nodes of this type, or T_NONE for any
+ *  - found: called with the path of each match, FAIL stops the find
+ *  - arg: given to found
+ *  - List: locks held by this thread
+ * Returns:
+ *  number of matches: if the directory was found
+ *                FAIL: otherwise
+ */
+int find(parsed_path *path, char *pattern, type nType, int (*found)(char *path, void *arg), void *arg, list *List) {
+	char full_pattern[MAX_FILE_NAME], prefix[MAX_FILE_NAME];
+	char *saveptr;
+	int inumber, depth;
+	find_walk walk = { .nType = nType, .found = found, .arg = arg };
+
+	type dType;
+	union Data data;
+
+	snprintf(full_pattern, sizeof(full_pattern), "%s", *pattern ? pattern : "**");
+	for (char *component = strtok_r(full_pattern, "/", &saveptr); component != NULL;
+	        component = strtok_r(NULL, "/", &saveptr)) {
+		/* ** / ** is **, walking it twice would only find the same nodes again */
+		if (walk.count > 0 && strcmp(component, "**") == 0 &&
+		        strcmp(walk.components[walk.count - 1], "**") == 0)
+			continue;
+		walk.components[walk.count++] = component;
+	}
+
+	inumber = lookup_path(path, path->count, List, 0, lockCoupling, &depth);
+	if (inumber == FAIL || inode_get(inumber, &dType, &data) == FAIL || dType != T_DIRECTORY)
+		return FAIL;
+
+	/* paths are reported as /a/b, whatever the slashes of name */
+	snprintf(prefix, sizeof(prefix), "%s", path->name);
+	while (strlen(prefix) > 0 && prefix[strlen(prefix) - 1] == '/')
+		prefix[strlen(prefix) - 1] = '\0';
+
+	if (walk.count > 0)
+		find_in_dir(&walk, inumber, prefix, 0, depth);
+
+	return walk.matches;
+}
+
+
+/*
+ * Chooses if lookup, create and delete release the ancestors of a node
+ * as soon as the node is locked. Must be called before the threads start.
+ */
+void set_lock_coupling(int enabled) {
+	lockCoupling = enabled;
+}
+
+
+/*
+ * Lookup for a given path.
+ * Input:
+ *  - path: path of node
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int lookup(parsed_path *path, list* List, int doLockWrite) {
+	return lookup_path(path, path->count, List, doLockWrite, lockCoupling, NULL);
 }
 
 
@@ -1,19 +1,39 @@
 #ifndef FS_H
 #define FS_H
 #include "state.h"
+#include "path.h"
 #include "threads.h"
 #include "../lst/list.h"
 #include <pthread.h>
 
+/* Most paths a single command can lock at once */
+#define MAX_LOCK_PATHS 4
+/* Times create finds its parent without locks before locking the path */
+#define MAX_CREATE_RETRIES 3
+/* Threads sharing the children of the node of a recursive delete or copy */
+#define SUBTREE_MAX_THREADS 4
+/* A readdir cursor keeps the next entry in its low bits and the
+   generation of the directory above them, 0 is the first page */
+#define READDIR_SLOT_BITS 8
+#define READDIR_GENERATION_MASK 0x7fffff
+
 extern inode_t *inode_table;
 
 void init_fs();
 void destroy_fs();
 int is_dir_empty(DirEntry *dirEntries);
-int create(char *name, type nodeType, list *List);
-int move(char* nodeOrigin, char* nodeDestination, list *List);
-int delete(char *name, list *List);
-int lookup(char *name, list* List, int doLockWrite);
+int create(parsed_path *path, type nodeType, list *List);
+int move(parsed_path *nodeOrigin, parsed_path *nodeDestination, list *List);
+int delete(parsed_path *path, int recursive, list *List);
+int copy(parsed_path *origin, parsed_path *destination, list *List);
+int lookup(parsed_path *path, list* List, int doLockWrite);
+int stat_node(parsed_path *path, node_stat *st, list *List);
+int read_file(parsed_path *path, int (*reader)(char *contents, int size, void *arg), void *arg, list *List);
+int write_file(parsed_path *path, char *contents, int size, list *List);
+int find(parsed_path *path, char *pattern, type nType, int (*found)(char *path, void *arg), void *arg, list *List);
+int read_dir(parsed_path *path, int *cursor, char *names, int *size, list *List);
+void lookup_paths(parsed_path *paths[], int counts[], int writes[], int count, int inumbers[], list *List);
+void set_lock_coupling(int enabled);
 void print_tecnicofs_tree(FILE *fp);
 
 #endif /* FS_H */
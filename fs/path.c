@@ -0,0 +1,147 @@
+#include "path.h"
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "state.h"
+
+/*
+ * Adds the component ending at a separator (or at the end), if not empty.
+ * Returns: SUCCESS or FAIL if there are already max components
+ */
+static int add_component(path_component *components, int *count, int max, int *start, int end) {
+	if (end > *start) {
+		if (*count == max)
+			return FAIL;
+		components[*count].offset = *start;
+		components[*count].len = end - *start;
+		(*count)++;
+	}
+	*start = end + 1;
+	return SUCCESS;
+}
+
+
+/*
+ * Splits a path into its components, skipping empty ones (repeated,
+ * leading or trailing slashes). With SSE2 the path is read 16 bytes at a
+ * time, finding the slashes and the end of each block at once, and only
+ * the slashes are then looked at one by one. The blocks are aligned, so
+ * reading past the end never crosses into another page.
+ * Input:
+ *  - path: the path
+ *  - components: stores the components
+ *  - max: size of components
+ *  - length: if not NULL, stores the length of the path
+ * Returns:
+ *  number of components: if they fit in components
+ *                  FAIL: otherwise
+ */
+int path_split(const char *path, path_component *components, int max, int *length) {
+	int count = 0, start = 0, end;
+
+#ifdef __SSE2__
+	const __m128i slashes = _mm_set1_epi8('/');
+	const __m128i zeros = _mm_setzero_si128();
+	const char *block = (const char *) ((uintptr_t) path & ~(uintptr_t) 15);
+	/* bytes of the first block before the path */
+	int skip = path - block;
+
+	for (int base = -skip; ; base += 16, block += 16) {
+		__m128i bytes = _mm_load_si128((const __m128i *) block);
+		unsigned int slash = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, slashes));
+		unsigned int nul = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zeros));
+
+		if (base < 0) {
+			slash &= ~0u << skip;
+			nul &= ~0u << skip;
+		}
+		/* only the slashes before the end */
+		if (nul)
+			slash &= (nul & -nul) - 1;
+
+		for (; slash; slash &= slash - 1) {
+			if (add_component(components, &count, max, &start, base + __builtin_ctz(slash)) == FAIL)
+				return FAIL;
+		}
+
+		if (nul) {
+			end = base + __builtin_ctz(nul);
+			break;
+		}
+	}
+#else
+	for (end = 0; path[end] != '\0'; end++) {
+		if (path[end] == '/' && add_component(components, &count, max, &start, end) == FAIL)
+			return FAIL;
+	}
+#endif
+
+	if (add_component(components, &count, max, &start, end) == FAIL)
+		return FAIL;
+
+	if (length)
+		*length = end;
+	return count;
+}
+
+
+/*
+ * Parses a path for a command, see parsed_path.
+ * Input:
+ *  - path: stores the parsed path
+ *  - name: the path, kept by reference, shorter than MAX_FILE_NAME
+ * Returns:
+ *  number of components: if it isn't too long
+ *                  FAIL: otherwise
+ */
+int path_parse(parsed_path *path, char *name) {
+	path_component *last;
+	int length;
+
+	path->name = name;
+	path->parent = "";
+	path->child = path->split;
+	path->split[0] = '\0';
+
+	path->count = path_split(name, path->components, PATH_MAX_COMPONENTS, &length);
+	if (path->count == FAIL || length >= MAX_FILE_NAME) {
+		path->count = FAIL;
+		return FAIL;
+	}
+
+	memcpy(path->split, name, length + 1);
+	for (int i = 0; i < path->count; i++) {
+		path_component *component = &path->components[i];
+
+		component->hash = dir_name_hash(path->split + component->offset, component->len);
+	}
+
+	if (path->count == 0)
+		return 0;
+
+	/* deal with trailing slashes ( a/x vs a/x/ ) */
+	last = &path->components[path->count - 1];
+	path->split[last->offset + last->len] = '\0';
+	path->child = path->split + last->offset;
+
+	if (path->count > 1) {
+		path->split[last->offset - 1] = '\0';
+		path->parent = path->split;
+	}
+
+	return path->count;
+}
+
+/*
+ * Tells if component i of a path is the same name as component j of
+ * another, comparing their hashes and lengths first.
+ */
+int path_same_components(parsed_path *a, int i, parsed_path *b, int j) {
+	path_component *first = &a->components[i], *second = &b->components[j];
+
+	return first->hash == second->hash && first->len == second->len &&
+	        memcmp(a->split + first->offset, b->split + second->offset, first->len) == 0;
+}
@@ -0,0 +1,40 @@
+#ifndef PATH_H
+#define PATH_H
+#include "../tecnicofs-api-constants.h"
+
+/* Most components a path shorter than MAX_FILE_NAME can have */
+#define PATH_MAX_COMPONENTS (MAX_FILE_NAME / 2 + 1)
+
+/*
+ * A component of a path, as where it starts in the path, its length and
+ * its hash (see dir_name_hash), so the path is split without being copied
+ */
+typedef struct path_component {
+	int offset;
+	int len;
+	unsigned int hash;
+} path_component;
+
+/*
+ * A path parsed once for a whole command: its components, hashed, and a
+ * copy of it split into the path of the parent and the name of the node,
+ * which the components point into. Its first n components are the path
+ * of an ancestor, so those are walked without parsing anything again.
+ */
+typedef struct parsed_path {
+	/* the path as given */
+	char *name;
+	/* number of components, FAIL if there are too many */
+	int count;
+	path_component components[PATH_MAX_COMPONENTS];
+	/* parent path and node name, "" and the whole path for the root */
+	char *parent;
+	char *child;
+	char split[MAX_FILE_NAME];
+} parsed_path;
+
+int path_split(const char *path, path_component *components, int max, int *length);
+int path_parse(parsed_path *path, char *name);
+int path_same_components(parsed_path *a, int i, parsed_path *b, int j);
+
+#endif /* PATH_H */
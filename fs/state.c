@@ -2,34 +2,264 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <time.h>
 #include "state.h"
 
 #include "../er/error.h"
 #include "../thr/threads.h"
+#include "../sts/stats.h"
+#include "../sts/contention.h"
+#include "../lg/logging.h"
+#include "../slb/slab.h"
 #include "../tecnicofs-api-constants.h"
 
+/* The types apart, so looking for a free i-node reads a few cache lines */
+static type inode_types[INODE_TABLE_SIZE];
 inode_t inode_table[INODE_TABLE_SIZE];
+static inode_locks_t inode_locks[INODE_TABLE_SIZE];
+static inode_meta_t inode_meta[INODE_TABLE_SIZE];
+/* Apart too, read by every lookup and changed with the entries */
+static dir_filter inode_filters[INODE_TABLE_SIZE];
 
-void lockInumberRead(int inumber){
-    lockReadRW(&inode_table[inumber].lockP);
+/* When this thread took each inode lock, for the contention tracking */
+static __thread long long lockAcquiredAt[INODE_TABLE_SIZE];
+
+/*
+ * Takes an inode lock, timing the wait when contention is being tracked.
+ * Only a failed trylock counts as contended.
+ */
+static void lockInumber(int inumber, int depth, int doLockWrite){
+    long long waitStart;
+
+    if (!contentionEnabled()) {
+        if (doLockWrite)
+            lockWriteRW(&inode_locks[inumber].lockP.lock);
+        else
+            lockReadRW(&inode_locks[inumber].lockP.lock);
+        return;
+    }
+
+    waitStart = statsNow();
+    if ((doLockWrite ? tryLockWrite(&inode_locks[inumber].lockP.lock) : tryLockRead(&inode_locks[inumber].lockP.lock)) == 0) {
+        lockAcquiredAt[inumber] = waitStart;
+        contentionRecordAcquire(inumber, depth, doLockWrite, 0);
+        return;
+    }
+
+    if (doLockWrite)
+        lockWriteRW(&inode_locks[inumber].lockP.lock);
+    else
+        lockReadRW(&inode_locks[inumber].lockP.lock);
+
+    lockAcquiredAt[inumber] = statsNow();
+    contentionRecordAcquire(inumber, depth, doLockWrite, lockAcquiredAt[inumber] - waitStart);
+}
+
+void lockInumberRead(int inumber, int depth){
+    lockInumber(inumber, depth, 0);
 }
-void lockInumberWrite(int inumber){
-    lockWriteRW(&inode_table[inumber].lockP);
+void lockInumberWrite(int inumber, int depth){
+    lockInumber(inumber, depth, 1);
 }
 void unlockInumberRW(int inumber){
-    unlockRW(&inode_table[inumber].lockP);
+    if (contentionEnabled())
+        contentionRecordRelease(inumber, statsNow() - lockAcquiredAt[inumber]);
+
+    unlockRW(&inode_locks[inumber].lockP.lock);
+}
+
+/*
+ * Unlocks a lock taken with lockInumberRead, lockInumberWrite or
+ * lockEntryWrite, given its address (as kept in the list of locks of a thread).
+ */
+void unlockInumberItem(pthread_rwlock_t* _item){
+    size_t offset = ((char*) _item - (char*) inode_locks) % sizeof(inode_locks_t);
+
+    if (offset == offsetof(inode_locks_t, lockP))
+        unlockInumberRW(((char*) _item - (char*) inode_locks) / sizeof(inode_locks_t));
+    else
+        unlockRW(_item);
+}
+
+/*
+ * Hash of an entry name (FNV-1a).
+ * Input:
+ *  - name: the name, not necessarily ending with '\0'
+ *  - len: its length
+ */
+unsigned int dir_name_hash(const char *name, int len){
+    unsigned int hash = 2166136261u;
+
+    for (int i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+
+    return hash;
+}
+
+/* Counter of the name filter for the i-th hash of a name */
+static int filterSlot(unsigned int hash, int i){
+    static const unsigned int multipliers[DIR_FILTER_HASHES] = { 0x9e3779b1u, 0x85ebca77u };
+
+    /* the high bits of the product depend on every bit of the hash */
+    return (hash * multipliers[i]) >> (32 - DIR_FILTER_BITS);
+}
+
+/* Counts a name in or out of the filter of a directory */
+static void filterChange(int inumber, unsigned int hash, int delta){
+    for (int i = 0; i < DIR_FILTER_HASHES; i++)
+        __atomic_fetch_add(&inode_filters[inumber].counters[filterSlot(hash, i)], delta, __ATOMIC_RELAXED);
+}
+
+/* Tells if a name may be in a directory, 0 if it is surely not */
+static int filterMayContain(int inumber, unsigned int hash){
+    for (int i = 0; i < DIR_FILTER_HASHES; i++) {
+        if (__atomic_load_n(&inode_filters[inumber].counters[filterSlot(hash, i)], __ATOMIC_RELAXED) == 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Returns the lock guarding the entries of a directory with the given name.
+ * Commands adding or removing that name hold it for writing, together with
+ * the directory's own lock for reading, so different names can be changed
+ * at the same time.
+ * Input:
+ *  - inumber: identifier of the directory i-node
+ *  - hash: hash of the entry name
+ */
+pthread_rwlock_t* getEntryLock(int inumber, unsigned int hash){
+    return &inode_locks[inumber].entryLocks[hash % DIR_LOCK_STRIPES].lock;
+}
+
+/*
+ * Looks for an entry without taking any lock: each entry has a sequence
+ * number, odd while it is being changed, and the read is retried if it
+ * changed meanwhile.
+ * A name the filter of the directory rules out isn't looked for at all.
+ * Otherwise only the entries with the same hash have their names
+ * compared, with a memcmp of the length given.
+ * Input:
+ *  - dir_inumber: identifier of the directory i-node
+ *  - entries: entries of directory
+ *  - name: name of the entry, not necessarily ending with '\0'
+ *  - len: length of the name
+ *  - hash: hash of the name
+ * Returns:
+ *  inumber: of the entry, if found
+ *     FAIL: otherwise
+ */
+int dir_find_entry(int dir_inumber, DirEntry *entries, const char *name, int len, unsigned int hash){
+    if (!filterMayContain(dir_inumber, hash)) {
+        statsRecordFilter(FILTER_NEGATIVE);
+        return FAIL;
+    }
+
+    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
+        unsigned int seq, found;
+        int inumber;
+
+        do {
+            while ((seq = __atomic_load_n(&entries[i].seq, __ATOMIC_ACQUIRE)) & 1)
+                ;
+
+            inumber = __atomic_load_n(&entries[i].inumber, __ATOMIC_RELAXED);
+            found = inumber >= 0 && __atomic_load_n(&entries[i].hash, __ATOMIC_RELAXED) == hash &&
+                    len < MAX_FILE_NAME && memcmp(entries[i].name, name, len) == 0 && entries[i].name[len] == '\0';
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (__atomic_load_n(&entries[i].seq, __ATOMIC_RELAXED) != seq);
+
+        if (found) {
+            statsRecordFilter(FILTER_FOUND);
+            return inumber;
+        }
+    }
+
+    statsRecordFilter(FILTER_FALSE_POSITIVE);
+    return FAIL;
+}
+
+/*
+ * Reads an entry without taking any lock, like dir_find_entry.
+ * Input:
+ *  - entries: entries of directory
+ *  - slot: position of the entry
+ *  - name: stores the name of the entry, at least MAX_FILE_NAME long
+ * Returns:
+ *  inumber: of the entry, if it is in use
+ *     FAIL: otherwise
+ */
+int dir_read_entry(DirEntry *entries, int slot, char *name){
+    unsigned int seq;
+    int inumber;
+
+    do {
+        while ((seq = __atomic_load_n(&entries[slot].seq, __ATOMIC_ACQUIRE)) & 1)
+            ;
+
+        inumber = __atomic_load_n(&entries[slot].inumber, __ATOMIC_RELAXED);
+        if (inumber >= 0)
+            strncpy(name, entries[slot].name, MAX_FILE_NAME);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&entries[slot].seq, __ATOMIC_RELAXED) != seq);
+
+    if (inumber < 0)
+        return FAIL;
+
+    name[MAX_FILE_NAME - 1] = '\0';
+    return inumber;
+}
+
+/* Marks an entry as being changed, readers retry until it is done */
+static void entryWriteBegin(DirEntry *entry){
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void entryWriteEnd(DirEntry *entry){
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
 }
 
 void tryInumberRead(int inumber){
-    tryLockRead(&inode_table[inumber].lockP);
+    tryLockRead(&inode_locks[inumber].lockP.lock);
 }
 
 void tryInumberWrite(int inumber){
-    tryLockWrite(&inode_table[inumber].lockP);
+    tryLockWrite(&inode_locks[inumber].lockP.lock);
 }
 
 pthread_rwlock_t* getLockInumber(int inumber){
-    return &inode_table[inumber].lockP;
+    return &inode_locks[inumber].lockP.lock;
+}
+
+/* Nanoseconds since the epoch */
+static long long wallClock(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * Records a change of the contents of an i-node, which may happen under
+ * a read lock (names are added and removed holding one), hence atomic.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - size: the new size
+ *  - children: added to the number of children
+ */
+static void metaChanged(int inumber, int size, int children){
+    long long now = wallClock();
+    inode_meta_t *meta = &inode_meta[inumber];
+
+    if (children)
+        size = (__atomic_add_fetch(&meta->children, children, __ATOMIC_RELAXED)) * sizeof(DirEntry);
+    __atomic_store_n(&meta->size, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&meta->mtime, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&meta->ctime, now, __ATOMIC_RELAXED);
 }
 
 /*
@@ -40,16 +270,33 @@ void insert_delay(int cycles) {
 }
 
 
+/*
+ * Frees the entries of a directory or the contents of a file, those too
+ * large for a slab block have a buffer of their own.
+ */
+static void inode_free_data(int inumber) {
+    if (inode_types[inumber] == T_FILE && inode_meta[inumber].size >= FILE_DATA_SIZE)
+        free(inode_table[inumber].data.fileContents);
+    else
+        slabFree(inode_types[inumber] == T_DIRECTORY ? SLAB_DIRECTORY : SLAB_FILE, inode_table[inumber].data.dirEntries);
+}
+
+
 /*
  * Initializes the i-nodes table.
  */
 void inode_table_init() {
+    slabInit(SLAB_DIRECTORY, sizeof(DirEntry) * MAX_DIR_ENTRIES);
+    slabInit(SLAB_FILE, FILE_DATA_SIZE);
 
     for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        inode_table[i].nodeType = T_NONE;
+        inode_types[i] = T_NONE;
+        inode_table[i].generation = 0;
         inode_table[i].data.dirEntries = NULL;
         inode_table[i].data.fileContents = NULL;
-        initLockRW(&inode_table[i].lockP);
+        initLockRW(&inode_locks[i].lockP.lock);
+        for (int j = 0; j < DIR_LOCK_STRIPES; j++)
+            initLockRW(&inode_locks[i].entryLocks[j].lock);
     }
 }
 
@@ -60,13 +307,11 @@ void inode_table_init() {
 void inode_table_destroy() {
     
     for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-            if (inode_table[i].data.dirEntries)
-                free(inode_table[i].data.dirEntries);
-            destroyRW(&inode_table[i].lockP);
-        }
+        if (inode_types[i] != T_NONE)
+            inode_free_data(i);
+        destroyRW(&inode_locks[i].lockP.lock);
+        for (int j = 0; j < DIR_LOCK_STRIPES; j++)
+            destroyRW(&inode_locks[i].entryLocks[j].lock);
     }
 }
 
@@ -82,41 +327,54 @@ int inode_create(type nType) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if(tryLockRead(&inode_table[inumber].lockP)!=0){
+    /* threads pinned to each NUMA node start at their own part of the table */
+    int start = getThreadNode() * INODE_TABLE_SIZE / getNumberNodes();
+
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        int inumber = (start + i) % INODE_TABLE_SIZE;
+
+        /* only lock the ones that look free */
+        if (__atomic_load_n(&inode_types[inumber], __ATOMIC_RELAXED) != T_NONE)
+            continue;
+
+        /* skip the i-nodes someone is using, a free one nobody holds is enough */
+        if(tryLockWrite(&inode_locks[inumber].lockP.lock)!=0){
             continue;
         }
 
-        if (inode_table[inumber].nodeType == T_NONE){
+        if (inode_types[inumber] == T_NONE){
 
-            unlockRW(&inode_table[inumber].lockP);
-            lockWriteRW(&inode_table[inumber].lockP);
+            __atomic_fetch_add(&inode_table[inumber].generation, 1, __ATOMIC_RELEASE);
 
-            if (inode_table[inumber].nodeType == T_NONE) {
+            if (nType == T_DIRECTORY) {
+                /* Initializes entry table before anyone can see it (see inode_peek) */
+                DirEntry *entries = slabAlloc(SLAB_DIRECTORY);
                 
-                inode_table[inumber].nodeType = nType;
-
-                if (nType == T_DIRECTORY) {
-                    /* Initializes entry table */
-                    inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-                    
-                    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-                        inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-                    }
-                }
-                else {
-                    inode_table[inumber].data.fileContents = NULL;
+                for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
+                    entries[i].inumber = FREE_INODE;
+                    entries[i].name[0] = '\0';
+                    entries[i].hash = 0;
+                    entries[i].seq = 0;
                 }
-
+                memset(&inode_filters[inumber], 0, sizeof(dir_filter));
+                __atomic_store_n(&inode_table[inumber].data.dirEntries, entries, __ATOMIC_RELEASE);
+            }
+            else {
+                inode_table[inumber].data.fileContents = NULL;
             }
 
-            unlockRW(&inode_table[inumber].lockP);
+            inode_meta[inumber].children = 0;
+            metaChanged(inumber, 0, 0);
+
+            __atomic_store_n(&inode_types[inumber], nType, __ATOMIC_RELEASE);
+
+            unlockRW(&inode_locks[inumber].lockP.lock);
 
             return inumber;                
         } 
 
 
-        unlockRW(&inode_table[inumber].lockP);
+        unlockRW(&inode_locks[inumber].lockP.lock);
     }
 
     return FAIL;
@@ -135,19 +393,19 @@ int inode_delete(int inumber) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_types[inumber] == T_NONE)) {
 
-        printf("inode_delete: invalid inumber\n");
+        logMessage(LOG_ERROR, "inode_delete: invalid inumber\n");
         
         return FAIL;
     } 
 
 
-    inode_table[inumber].nodeType = T_NONE;
-    /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
-    destroyRW(&inode_table[inumber].lockP);
+    inode_free_data(inumber);
+    __atomic_store_n(&inode_table[inumber].data.dirEntries, NULL, __ATOMIC_RELAXED);
+    /* the lock stays, it may still be held and is reused by the next i-node */
+    __atomic_store_n(&inode_types[inumber], T_NONE, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&inode_table[inumber].generation, 1, __ATOMIC_RELEASE);
 
     return SUCCESS;
 
@@ -166,14 +424,14 @@ int inode_get(int inumber, type *nType, union Data *data) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
-        printf("inode_get: invalid inumber %d\n", inumber);
+    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_types[inumber] == T_NONE)) {
+        logMessage(LOG_ERROR, "inode_get: invalid inumber %d\n", inumber);
 
         return FAIL;
     }
 
     if (nType)
-        *nType = inode_table[inumber].nodeType;
+        *nType = inode_types[inumber];
 
     if (data)
         *data = inode_table[inumber].data;
@@ -182,6 +440,162 @@ int inode_get(int inumber, type *nType, union Data *data) {
 }
 
 
+/*
+ * Copies the contents of the i-node without holding its lock, the i-node
+ * may be deleted or created again meanwhile. Callers lock it later and
+ * compare the generation to know if what they read is still valid.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - nType: pointer to type
+ *  - data: pointer to data
+ *  - generation: pointer to the generation the contents belong to
+ * Returns: SUCCESS or FAIL
+ */
+int inode_peek(int inumber, type *nType, union Data *data, unsigned int *generation) {
+    /* Used for testing synchronization speedup */
+    insert_delay(DELAY);
+
+    /* the inumber may come from a table being changed, don't trust it */
+    if ((inumber < 0) || (inumber >= INODE_TABLE_SIZE))
+        return FAIL;
+
+    *generation = __atomic_load_n(&inode_table[inumber].generation, __ATOMIC_ACQUIRE);
+    *nType = __atomic_load_n(&inode_types[inumber], __ATOMIC_ACQUIRE);
+    data->dirEntries = __atomic_load_n(&inode_table[inumber].data.dirEntries, __ATOMIC_ACQUIRE);
+
+    if (*nType == T_NONE)
+        return FAIL;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Returns the generation of the i-node, stable while its lock is held.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+unsigned int inode_generation(int inumber) {
+    return __atomic_load_n(&inode_table[inumber].generation, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Copies the metadata of an i-node, O(1) as it is kept up to date by
+ * every change. The i-node must be locked, at least for reading.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - st: stores the metadata
+ * Returns: SUCCESS or FAIL
+ */
+int inode_stat(int inumber, node_stat *st) {
+    inode_meta_t *meta = &inode_meta[inumber];
+
+    if ((inumber < 0) || (inumber >= INODE_TABLE_SIZE) || (inode_types[inumber] == T_NONE))
+        return FAIL;
+
+    st->type = inode_types[inumber];
+    st->generation = inode_generation(inumber);
+    st->size = __atomic_load_n(&meta->size, __ATOMIC_RELAXED);
+    st->children = __atomic_load_n(&meta->children, __ATOMIC_RELAXED);
+    st->mtime = __atomic_load_n(&meta->mtime, __ATOMIC_RELAXED);
+    st->ctime = __atomic_load_n(&meta->ctime, __ATOMIC_RELAXED);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Records that an i-node was moved to another directory: its metadata
+ * changed now (not its contents, nor its mtime), and so does its
+ * generation, as for whoever found it at its old path without locks it
+ * is no longer there. It must be locked for writing.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void inode_moved(int inumber) {
+    __atomic_store_n(&inode_meta[inumber].ctime, wallClock(), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&inode_table[inumber].generation, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Sets the contents of a file.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - fileContents: the new contents
+ *  - len: size of the contents, must be smaller than FILE_MAX_SIZE
+ * Returns: SUCCESS or FAIL
+ */
+int inode_set_file(int inumber, char *fileContents, int len) {
+    char *contents;
+    int size;
+
+    /* Used for testing synchronization speedup */
+    insert_delay(DELAY);
+
+    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_types[inumber] == T_NONE)) {
+        logMessage(LOG_ERROR, "inode_set_file: invalid inumber %d\n", inumber);
+
+        return FAIL;
+    }
+
+    if (inode_types[inumber] != T_FILE) {
+        logMessage(LOG_ERROR, "inode_set_file: can only set the contents of files\n");
+
+        return FAIL;
+    }
+
+    if ((len < 0) || (len >= FILE_MAX_SIZE)) {
+        logMessage(LOG_ERROR, "inode_set_file: contents too large\n");
+
+        return FAIL;
+    }
+
+    contents = inode_table[inumber].data.fileContents;
+    size = inode_meta[inumber].size;
+
+    /* a slab block fits any small contents, a buffer of its own only the same size */
+    if (contents == NULL || ((len >= FILE_DATA_SIZE || size >= FILE_DATA_SIZE) && len != size)) {
+        contents = len < FILE_DATA_SIZE ? slabAlloc(SLAB_FILE) : malloc(len + 1);
+
+        if (contents == NULL) {
+            logMessage(LOG_ERROR, "inode_set_file: couldn't allocate contents\n");
+
+            return FAIL;
+        }
+
+        if (inode_table[inumber].data.fileContents != NULL)
+            inode_free_data(inumber);
+        inode_table[inumber].data.fileContents = contents;
+    }
+
+    memcpy(contents, fileContents, len);
+    contents[len] = '\0';
+    metaChanged(inumber, len, 0);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Gets the contents of a file, valid while it is locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - fileContents: stores the contents, NULL if it has none yet, may be NULL
+ * Returns: the size of the contents, or FAIL if it isn't a file
+ */
+int inode_get_file(int inumber, char **fileContents) {
+    if ((inumber < 0) || (inumber >= INODE_TABLE_SIZE) || (inode_types[inumber] != T_FILE))
+        return FAIL;
+
+    if (fileContents)
+        *fileContents = inode_table[inumber].data.fileContents;
+
+    return inode_meta[inumber].size;
+}
+
+
 /*
  * Resets an entry for a directory.
  * Input:
@@ -193,29 +607,43 @@ int dir_reset_entry(int inumber, int sub_inumber) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
-        printf("inode_reset_entry: invalid inumber\n");
+    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_types[inumber] == T_NONE)) {
+        logMessage(LOG_ERROR, "inode_reset_entry: invalid inumber\n");
 
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
-        printf("inode_reset_entry: can only reset entry to directories\n");
+    if (inode_types[inumber] != T_DIRECTORY) {
+        logMessage(LOG_ERROR, "inode_reset_entry: can only reset entry to directories\n");
 
         return FAIL;
     }
 
-    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
-        printf("inode_reset_entry: invalid entry inumber\n");
+    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_types[sub_inumber] == T_NONE)) {
+        logMessage(LOG_ERROR, "inode_reset_entry: invalid entry inumber\n");
 
         return FAIL;
     }
 
     
     for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
+        DirEntry *entry = &inode_table[inumber].data.dirEntries[i];
+        int expected = sub_inumber;
+
+        /* reserve it first, so no one else takes it until it is cleared */
+        if (__atomic_compare_exchange_n(&entry->inumber, &expected, RESERVED_INODE,
+                0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            unsigned int hash = entry->hash;
+
+            entryWriteBegin(entry);
+            entry->name[0] = '\0';
+            __atomic_store_n(&entry->hash, 0, __ATOMIC_RELAXED);
+            entryWriteEnd(entry);
+            /* only once the entry can't be found */
+            filterChange(inumber, hash, -1);
+
+            __atomic_store_n(&entry->inumber, FREE_INODE, __ATOMIC_RELEASE);
+            metaChanged(inumber, 0, -1);
             
             return SUCCESS;
         }
@@ -232,41 +660,53 @@ int dir_reset_entry(int inumber, int sub_inumber) {
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
  *  - sub_name: name of the sub i-node entry 
+ *  - hash: hash of the name (see dir_name_hash)
  * Returns: SUCCESS or FAIL
  */
-int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
+int dir_add_entry(int inumber, int sub_inumber, char *sub_name, unsigned int hash) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
-        printf("inode_add_entry: invalid inumber\n");
+    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_types[inumber] == T_NONE)) {
+        logMessage(LOG_ERROR, "inode_add_entry: invalid inumber\n");
 
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
-        printf("inode_add_entry: can only add entry to directories\n");
+    if (inode_types[inumber] != T_DIRECTORY) {
+        logMessage(LOG_ERROR, "inode_add_entry: can only add entry to directories\n");
 
         return FAIL;
     }
 
-    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
-        printf("inode_add_entry: invalid entry inumber\n");
+    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_types[sub_inumber] == T_NONE)) {
+        logMessage(LOG_ERROR, "inode_add_entry: invalid entry inumber\n");
 
         return FAIL;
     }
 
     if (strlen(sub_name) == 0 ) {
-        printf("inode_add_entry: \
+        logMessage(LOG_ERROR, "inode_add_entry: \
                entry name must be non-empty\n");
 
         return FAIL;
     }
     
     for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
+        DirEntry *entry = &inode_table[inumber].data.dirEntries[i];
+        int expected = FREE_INODE;
+
+        /* other names may be added at the same time, claim the entry first */
+        if (__atomic_compare_exchange_n(&entry->inumber, &expected, RESERVED_INODE,
+                0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            /* before the entry can be found */
+            filterChange(inumber, hash, 1);
+            entryWriteBegin(entry);
+            strcpy(entry->name, sub_name);
+            __atomic_store_n(&entry->hash, hash, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->inumber, sub_inumber, __ATOMIC_RELAXED);
+            entryWriteEnd(entry);
+            metaChanged(inumber, 0, 1);
 
             return SUCCESS;
         }
@@ -284,12 +724,12 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
  */
 void inode_print_tree(FILE *fp, int inumber, char *name) {
 
-    if (inode_table[inumber].nodeType == T_FILE) {
+    if (inode_types[inumber] == T_FILE) {
         fprintf(fp, "%s\n", name);
         return;
     }
 
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
+    if (inode_types[inumber] == T_DIRECTORY) {
         fprintf(fp, "%s\n", name);
         for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
             if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
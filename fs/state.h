@@ -11,8 +11,21 @@
 #define FS_ROOT 0
 
 #define FREE_INODE -1
+/* Entry taken by a command that is still filling or clearing it */
+#define RESERVED_INODE -2
 #define INODE_TABLE_SIZE 50
 #define MAX_DIR_ENTRIES 20
+/* Contents smaller than this take a slab block, larger ones (up to
+   FILE_MAX_SIZE) a buffer of their own */
+#define FILE_DATA_SIZE 1024
+/* Locks per directory guarding its entry names, see getEntryLock */
+#define DIR_LOCK_STRIPES 8
+/* Counters of the name filter of a directory (2^DIR_FILTER_BITS), and
+   how many of them each name counts in */
+#define DIR_FILTER_BITS 7
+#define DIR_FILTER_COUNTERS (1 << DIR_FILTER_BITS)
+#define DIR_FILTER_HASHES 2
+#define CACHE_LINE_SIZE 64
 
 #define SUCCESS 0
 #define FAIL -1
@@ -21,11 +34,14 @@
 
 
 /*
- * Contains the name of the entry and respective i-number
+ * Contains the name of the entry and respective i-number,
+ * the hash of the name and a sequence number (odd while it is being changed)
  */
 typedef struct dirEntry {
 	char name[MAX_FILE_NAME];
 	int inumber;
+	unsigned int hash;
+	unsigned int seq;
 } DirEntry;
 
 /*
@@ -37,27 +53,75 @@ union Data {
 };
 
 /*
- * I-node definition
+ * I-node definition, the part read by every lookup. The type and the
+ * locks are kept in arrays of their own (see state.c), so taking the lock
+ * of an i-node doesn't invalidate the data of its neighbours.
+ * The generation changes every time it is created, deleted or moved
  */
-typedef struct inode_t {    
-	type nodeType;
+typedef struct inode_t {
 	union Data data;
-    pthread_rwlock_t lockP;
+	unsigned int generation;
 } inode_t;
 
+/*
+ * Metadata of an i-node, kept apart from the part read by every lookup
+ * and changed along with the contents, so stat is a copy
+ */
+typedef struct inode_meta_t {
+	int size;
+	int children;
+	long long mtime;
+	long long ctime;
+} inode_meta_t;
+
+/*
+ * A lock alone in its cache line
+ */
+typedef struct inode_lock {
+	pthread_rwlock_t lock;
+} __attribute__((aligned(CACHE_LINE_SIZE))) inode_lock;
+
+/*
+ * Counting Bloom filter of the names in a directory: each name adds one to
+ * DIR_FILTER_HASHES counters picked by its hash, so a name with any of them
+ * at zero isn't there. A counter can't go over MAX_DIR_ENTRIES *
+ * DIR_FILTER_HASHES, so a byte is enough.
+ */
+typedef struct dir_filter {
+	unsigned char counters[DIR_FILTER_COUNTERS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) dir_filter;
+
+/*
+ * Locks of an i-node, see getLockInumber and getEntryLock
+ */
+typedef struct inode_locks_t {
+	inode_lock lockP;
+	inode_lock entryLocks[DIR_LOCK_STRIPES];
+} inode_locks_t;
+
 void insert_delay(int cycles);
 void inode_table_init();
 void inode_table_destroy();
 int inode_create(type nType);
 int inode_delete(int inumber);
 int inode_get(int inumber, type *nType, union Data *data);
+int inode_peek(int inumber, type *nType, union Data *data, unsigned int *generation);
+unsigned int inode_generation(int inumber);
+int inode_stat(int inumber, node_stat *st);
+void inode_moved(int inumber);
 int inode_set_file(int inumber, char *fileContents, int len);
+int inode_get_file(int inumber, char **fileContents);
 int dir_reset_entry(int inumber, int sub_inumber);
-int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
+int dir_add_entry(int inumber, int sub_inumber, char *sub_name, unsigned int hash);
+int dir_find_entry(int dir_inumber, DirEntry *entries, const char *name, int len, unsigned int hash);
+int dir_read_entry(DirEntry *entries, int slot, char *name);
+unsigned int dir_name_hash(const char *name, int len);
 void inode_print_tree(FILE *fp, int inumber, char *name);
 
-void lockInumberRead(int inumber);
-void lockInumberWrite(int inumber);
+void lockInumberRead(int inumber, int depth);
+void lockInumberWrite(int inumber, int depth);
 void unlockInumberRW(int inumber);
+void unlockInumberItem(pthread_rwlock_t* _item);
 pthread_rwlock_t* getLockInumber(int inumber);
+pthread_rwlock_t* getEntryLock(int inumber, unsigned int hash);
 #endif /* INODES_H */
@@ -0,0 +1,225 @@
+#include "logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../er/error.h"
+
+/*
+ * Lines written by one thread and not yet drained.
+ * Single producer (the owner thread moves head) and single consumer
+ * (the drain thread moves tail), so neither side takes a lock.
+ */
+typedef struct logRing {
+    int inUse;
+    unsigned long head;
+    unsigned long tail;
+    unsigned long dropped;
+    unsigned long seen;
+    int id;
+    char lines[LOG_RING_SIZE][LOG_LINE_SIZE];
+} logRing;
+
+static logRing rings[LOG_MAX_THREADS];
+static int usedRings = 0;
+static __thread logRing *myRing = NULL;
+
+static int minLevel = LOG_INFO;
+static int sampleEvery = 1;
+static int stopping = 0;
+static int started = 0;
+static pthread_t drainThread;
+
+static const char *levelNames[] = { "debug", "info", "warn", "error" };
+
+/* Returns the ring of the calling thread, NULL if there are none left */
+static logRing *getMyRing(){
+    if (myRing != NULL)
+        return myRing;
+
+    for (int slot = 0; slot < LOG_MAX_THREADS; slot++) {
+        int expected = 0, used = __atomic_load_n(&usedRings, __ATOMIC_RELAXED);
+
+        if (!__atomic_compare_exchange_n(&rings[slot].inUse, &expected, 1,
+                0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        /* the drain thread looks at the rings up to the last one ever used */
+        while (used < slot + 1 && !__atomic_compare_exchange_n(&usedRings, &used, slot + 1,
+                0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        myRing = &rings[slot];
+        myRing->id = slot;
+        return myRing;
+    }
+    return NULL;
+}
+
+/* Formats a line, always ending it with a newline */
+static void formatLine(char *line, int level, int id, const char *format, va_list args){
+    int len = snprintf(line, LOG_LINE_SIZE, "%s t%d: ", levelNames[level], id);
+
+    vsnprintf(line + len, LOG_LINE_SIZE - len, format, args);
+
+    len = strlen(line);
+    if (len == LOG_LINE_SIZE - 1)
+        len--;
+    if (len == 0 || line[len - 1] != '\n') {
+        line[len] = '\n';
+        line[len + 1] = '\0';
+    }
+}
+
+/*
+ * Writes every pending line to stdout.
+ * Returns: number of lines written
+ */
+static int drainRings(){
+    int written = 0;
+    int count = __atomic_load_n(&usedRings, __ATOMIC_ACQUIRE);
+
+    if (count > LOG_MAX_THREADS)
+        count = LOG_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        logRing *ring = &rings[i];
+        unsigned long tail = ring->tail;
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+
+        for (; tail != head; tail++, written++)
+            fputs(ring->lines[tail & (LOG_RING_SIZE - 1)], stdout);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        if (dropped) {
+            printf("warn t%d: %lu log messages dropped\n", ring->id, dropped);
+            written++;
+        }
+    }
+
+    if (written)
+        fflush(stdout);
+
+    return written;
+}
+
+static void *drainLoop(void *arg){
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (drainRings() == 0)
+            usleep(LOG_DRAIN_PERIOD_US);
+    }
+    drainRings();
+
+    return NULL;
+}
+
+
+/*
+ * Maps a level name (debug, info, warn or error) to its level.
+ * Returns: the level or -1 if the name is not known
+ */
+int logParseLevel(const char *name){
+    for (int level = LOG_DEBUG; level <= LOG_ERROR; level++) {
+        if (!strcasecmp(name, levelNames[level]))
+            return level;
+    }
+    return -1;
+}
+
+/*
+ * Messages below the given level are discarded.
+ */
+void logSetLevel(int level){
+    minLevel = level;
+}
+
+/*
+ * Only one of every given number of messages below error is kept,
+ * counted per thread.
+ */
+void logSetSampling(int every){
+    sampleEvery = every > 1 ? every : 1;
+}
+
+/*
+ * Starts the thread that writes the logged messages to stdout.
+ */
+void logInit(){
+    if (pthread_create(&drainThread, NULL, drainLoop, NULL) != 0)
+        errorParse("Error while creating log thread.\n");
+    started = 1;
+}
+
+/*
+ * Writes the pending messages and stops the log thread.
+ */
+void logDestroy(){
+    if (!started)
+        return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    if (pthread_join(drainThread, NULL))
+        errorParse("Error while joining the log thread\n");
+    started = 0;
+}
+
+/*
+ * Gives the ring of the calling thread to the next thread that logs,
+ * its pending lines are still written. Called when a thread finishes.
+ */
+void logThreadExit(){
+    if (myRing == NULL)
+        return;
+
+    __atomic_store_n(&myRing->inUse, 0, __ATOMIC_RELEASE);
+    myRing = NULL;
+}
+
+/*
+ * Logs a message without blocking: it is copied into the ring of the
+ * calling thread and written by the log thread. Messages are dropped
+ * (and counted) while the ring is full.
+ * Input:
+ *  - level: level of the message
+ *  - format: printf format, followed by its arguments
+ */
+void logMessage(int level, const char *format, ...){
+    logRing *ring;
+    unsigned long head;
+    va_list args;
+
+    if (level < minLevel)
+        return;
+
+    ring = started ? getMyRing() : NULL;
+
+    if (ring == NULL) {
+        /* no ring for this thread, write it right away */
+        char line[LOG_LINE_SIZE];
+
+        va_start(args, format);
+        formatLine(line, level, -1, format, args);
+        va_end(args);
+        fputs(line, stdout);
+        return;
+    }
+
+    if (level < LOG_ERROR && ring->seen++ % sampleEvery != 0)
+        return;
+
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    va_start(args, format);
+    formatLine(ring->lines[head & (LOG_RING_SIZE - 1)], level, ring->id, format, args);
+    va_end(args);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
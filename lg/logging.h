@@ -0,0 +1,28 @@
+#ifndef LG_H
+#define LG_H
+
+/* Threads with their own ring, the others write straight to stdout */
+#define LOG_MAX_THREADS 64
+/* Lines per ring, must be a power of two */
+#define LOG_RING_SIZE 128
+#define LOG_LINE_SIZE 192
+/* How long the drain thread sleeps when every ring is empty */
+#define LOG_DRAIN_PERIOD_US 5000
+
+typedef enum logLevel {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} logLevel;
+
+int logParseLevel(const char *name);
+void logSetLevel(int level);
+void logSetSampling(int every);
+void logInit();
+void logDestroy();
+void logThreadExit();
+void logMessage(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
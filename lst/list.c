@@ -106,10 +106,10 @@ list* freeItemsList(list* List, void (*unlockItem)(pthread_rwlock_t*)){
             unlockItem(current->item);
             free(current);
             }
-        }
 
-    unlockItem(current->item);
-    free(current);
+        unlockItem(current->item);
+        free(current);
+        }
 
     List->head = List->tail = NULL;
     return List;
@@ -12,18 +12,34 @@
 #include <strings.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
 
 #include "lst/list.h"
 #include "fs/operations.h"
 #include "fh/fileHandling.h"
 #include "thr/threads.h"
 #include "er/error.h"
+#include "sts/stats.h"
+#include "sts/contention.h"
+#include "lg/logging.h"
+#include "slb/slab.h"
+#include "sch/scheduler.h"
+#include "wt/watch.h"
+#include "wt/lease.h"
 
 //server constants and variables
-#define INDIM 30
 #define OUTDIM 512
 #define TRUE 1
 
+/* sscanf conversion of a name: one longer than a valid name still fits in
+   MAX_FILE_NAME + 1, and is refused instead of cut to a valid one */
+#define STRINGIFY(x) #x
+#define WIDTH(x) STRINGIFY(x)
+#define NAME_FORMAT "%" WIDTH(MAX_FILE_NAME) "s"
+
+#define USAGE "Usage: tecnicofs numThreads nameServer [-a] [-c] [-k] [-l level] [-s N] [-m min] [-M max] [-i N] [-g policy] [-w] [-u]\n"
+
 char nameServer[108];
 int sockfd;
 struct sockaddr_un server_addr;
@@ -31,18 +47,84 @@ socklen_t addrlen;
 char *path;
 
 int numberThreads = 0;
+int minThreads = 0;
+int maxThreads = 0;
+int inflightLimit = SCHED_DEFAULT_INFLIGHT;
+
+/* Who goes first when print (quiescent) and modifying commands wait for each other */
+#define GATE_PRINT_FIRST 0
+#define GATE_MODIFY_FIRST 1
+#define GATE_PHASE_FAIR 2
+#define GATE_FIFO 3
+
+int gatePolicy = GATE_PRINT_FIRST;
 
 int modifyingThreads = 0;
+/* prints waiting or running, and only the running ones */
 int quiescenteThreads = 0;
+int activeQuiescente = 0;
+/* phase fair: modifiers waiting for the prints to end, the ones let in by
+   the last print that haven't come in yet, and print phases so far */
+int waitingModifying = 0;
+int releasedModifying = 0;
+int printPhase = 0;
+/* fifo: next ticket to give and the ticket that may come in */
+int nextTicket = 0;
+int servingTicket = 0;
 pthread_cond_t waitQuiescente = PTHREAD_COND_INITIALIZER;
 pthread_cond_t waitModifying = PTHREAD_COND_INITIALIZER;
 
+/* Maps a gate policy name to its policy, -1 if unknown */
+int parseGatePolicy(char *name){
+    const char *names[] = { "print", "modify", "phase", "fifo" };
+
+    for (int policy = GATE_PRINT_FIRST; policy <= GATE_FIFO; policy++)
+        if (!strcmp(name, names[policy]))
+            return policy;
+    return -1;
+}
+
 void startingModifyingCommand(){
+    long long waitStart = statsNow();
+    int phase, ticket;
+
     lockMutex();
-    while(quiescenteThreads != 0)
-        wait(&waitModifying);
+    switch (gatePolicy) {
+        case GATE_PRINT_FIRST:
+            /* a waiting print keeps new modifiers out */
+            while(quiescenteThreads != 0)
+                wait(&waitModifying);
+            break;
+        case GATE_MODIFY_FIRST:
+            while(activeQuiescente != 0)
+                wait(&waitModifying);
+            break;
+        case GATE_PHASE_FAIR:
+            /* wait for the prints waiting or running now, but not for later ones */
+            if (quiescenteThreads != 0) {
+                phase = printPhase;
+                waitingModifying++;
+                while(printPhase == phase)
+                    wait(&waitModifying);
+                waitingModifying--;
+                if (--releasedModifying == 0)
+                    broadcast(&waitQuiescente);
+            }
+            break;
+        case GATE_FIFO:
+            /* in arrival order, modifiers after modifiers come in together */
+            ticket = nextTicket++;
+            while(ticket != servingTicket || activeQuiescente != 0)
+                wait(&waitModifying);
+            servingTicket++;
+            broadcast(&waitModifying);
+            broadcast(&waitQuiescente);
+            break;
+    }
     modifyingThreads++;
     unlockMutex();
+
+    statsRecordQueue(statsNow() - waitStart);
 }
 
 void finishingModifyingCommand(){
@@ -53,53 +135,169 @@ void finishingModifyingCommand(){
 }
 
 void startQuiescenteCommand(){
+    long long waitStart = statsNow();
+    int ticket;
+
     lockMutex();
     quiescenteThreads++;
-    while(modifyingThreads != 0)
-        wait(&waitQuiescente);
-
+    switch (gatePolicy) {
+        case GATE_PRINT_FIRST:
+        case GATE_MODIFY_FIRST:
+            while(modifyingThreads != 0)
+                wait(&waitQuiescente);
+            break;
+        case GATE_PHASE_FAIR:
+            /* let the modifiers of the last phase in first, and don't join
+               running prints while modifiers wait for them */
+            while(modifyingThreads != 0 || releasedModifying != 0 ||
+                    (activeQuiescente != 0 && waitingModifying != 0))
+                wait(&waitQuiescente);
+            break;
+        case GATE_FIFO:
+            ticket = nextTicket++;
+            while(ticket != servingTicket || modifyingThreads != 0)
+                wait(&waitQuiescente);
+            servingTicket++;
+            broadcast(&waitModifying);
+            broadcast(&waitQuiescente);
+            break;
+    }
+    activeQuiescente++;
     unlockMutex();
 
+    statsRecordQueue(statsNow() - waitStart);
 }
 
 void finishingQuiescenteCommand(){
     lockMutex();
     quiescenteThreads--;
+    /* the end of a print phase lets the modifiers waiting for it in */
+    if (--activeQuiescente == 0 && waitingModifying != 0) {
+        releasedModifying = waitingModifying;
+        printPhase++;
+    }
     broadcast(&waitModifying);
+    broadcast(&waitQuiescente);
     unlockMutex();
 }
 
+/*
+ * Paths found by a find, kept until its locks are released so a client
+ * slow to read the replies never holds them (see findSend)
+ */
+typedef struct findReply {
+    size_t used;
+    /* each node matches at most once */
+    char paths[INODE_TABLE_SIZE * MAX_FILE_NAME];
+} findReply;
+
+/* Adds a path found to the reply */
+int findCollect(char *path, void *arg){
+    findReply *reply = arg;
+    size_t len = strlen(path) + 1;
+
+    if (reply->used + len > sizeof(reply->paths))
+        return FAIL;
+
+    memcpy(reply->paths + reply->used, path, len);
+    reply->used += len;
+
+    return SUCCESS;
+}
+
+/*
+ * Sends the paths found by a find in as many replies as they need, each
+ * with the number of paths in it and a flag saying if more follow.
+ * Input:
+ *  - request: the find
+ *  - reply: the paths
+ *  - result: what find returned
+ */
+void findSend(schedRequest *request, findReply *reply, int result){
+    char page[MAX_REPLY_SIZE - sizeof(int)];
+    int more = 1, last = 0, count = 0;
+    size_t used = sizeof(int), len;
+
+    for (char *path = reply->paths; result != FAIL && path < reply->paths + reply->used; path += len) {
+        len = strlen(path) + 1;
+
+        if (used + len > sizeof(page)) {
+            memcpy(page, &more, sizeof(int));
+            if (schedSendData(request, count, page, used) == FAIL)
+                break;
+            count = 0;
+            used = sizeof(int);
+        }
+
+        memcpy(page + used, path, len);
+        used += len;
+        count++;
+    }
+
+    memcpy(page, &last, sizeof(int));
+    schedReplyData(request, result == FAIL ? FAIL : count, page, result == FAIL ? 0 : used);
+}
+
+/*
+ * Contents of a file read, see readContents
+ */
+typedef struct readReply {
+    /* a memfd holding them when they don't fit in the reply, else -1 */
+    int fd;
+    char page[FILE_INLINE_MAX];
+} readReply;
+
+/* Copies the contents of a file out while it is locked */
+int readContents(char *contents, int size, void *arg){
+    readReply *reply = arg;
+
+    if (size <= FILE_INLINE_MAX) {
+        if (size > 0)
+            memcpy(reply->page, contents, size);
+        return size;
+    }
+
+    reply->fd = createSharedFile(contents, size);
+    return reply->fd < 0 ? FAIL : size;
+}
+
 void applyCommands(list* List){
     
     while(TRUE){
 
             char token;
-            char typeAndName[MAX_FILE_NAME];
-            char name[MAX_FILE_NAME]; 
-            struct sockaddr_un client_addr;
-            char in_buffer[INDIM];
-            int c;
-
-            addrlen=sizeof(struct sockaddr_un);
-            c = recvfrom(sockfd, in_buffer, sizeof(in_buffer)-1, 0, (struct sockaddr *)&client_addr, &addrlen);
+            char typeAndName[MAX_FILE_NAME + 1];
+            char name[MAX_FILE_NAME + 1];
+            parsed_path path, destination;
+            schedRequest request;
 
-            if (c <= 0) 
-                continue;
-            //Preventivo, caso o cliente nao tenha terminado a mensagem em '\0', 
-            in_buffer[c]='\0';
+            /* the pool has too many threads */
+            if (poolWorkerShouldExit(POOL_WORKER_WAITING))
+                return;
 
-            int numTokens = sscanf(in_buffer, "%c %s %s", &token, name, typeAndName);
+            int taken = schedTake(&request, POOL_IDLE_TIMEOUT_MS);
 
-            if (token == 't'){
+            if (taken != SUCCESS) {
+                if (poolWorkerShouldExit(taken == SCHED_TIMEOUT ? POOL_WORKER_TIMED_OUT : POOL_WORKER_DRAINED))
+                    return;
                 continue;
             }
+
+            poolWorkerBusy();
+
+            int numTokens = sscanf(request.message, "%c " NAME_FORMAT " " NAME_FORMAT, &token, name, typeAndName);
+
             //free(command);
             if (numTokens < 2)
                 errorParse("Error: invalid command in Queue\n");
             
-            printf("Recebeu mensagem de %s\n", client_addr.sun_path);
+            logMessage(LOG_DEBUG, "Recebeu mensagem de %s\n", request.client.sun_path);
+
+            /* parsed once, every operation of the command walks it */
+            path_parse(&path, name);
 
             int searchResult = FAIL;
+            long long serviceStart = statsNow();
 
             switch (token) {
                 case 'c':
@@ -107,55 +305,167 @@ void applyCommands(list* List){
                         case 'f':
                             startingModifyingCommand();
 
-                            searchResult = create(name, T_FILE, List);
+                            searchResult = create(&path, T_FILE, List);
 
                             finishingModifyingCommand();
-
-                            List = freeItemsList(List, unlockItem);           
-                            sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);
+                            List = freeItemsList(List, unlockInumberItem);           
+                            leaseRevoke(name);
+                            schedReply(&request, searchResult);
                             break;
                         case 'd':
                             startingModifyingCommand();
 
-                            searchResult = create(name, T_DIRECTORY, List);
+                            searchResult = create(&path, T_DIRECTORY, List);
 
                             finishingModifyingCommand();
-
-                            List = freeItemsList(List, unlockItem);
-                            sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                        
+                            List = freeItemsList(List, unlockInumberItem);
+                            leaseRevoke(name);
+                            schedReply(&request, searchResult);
                             break;
                         default:
                             searchResult = FAIL;
-                            sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                            
+                            schedReply(&request, searchResult);
                             errorParse("Error: invalid node type\n");
                     }
                     break;
-                case 'l':
-                    searchResult = lookup(name, List, 0);
-                    List = freeItemsList(List, unlockItem);
-                    sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                            
+                case 'l': {
+                    /* l <path> l also asks for a lease, answered after the inumber */
+                    int lease = 0;
+
+                    if (numTokens == 3 && typeAndName[0] == 'l')
+                        lease = leaseGrant(name, LEASE_LOOKUP, &request.client, request.clientLen);
+
+                    searchResult = lookup(&path, List, 0);
+                    List = freeItemsList(List, unlockInumberItem);
+                    schedReplyData(&request, searchResult, &lease, numTokens == 3 ? sizeof(lease) : 0);
+                    break;
+                }
+                case 'r': {
+                    /* the cursor of the next page, then the names */
+                    char page[MAX_REPLY_SIZE - sizeof(int)];
+                    int cursor = numTokens == 3 ? atoi(typeAndName) : 0;
+                    int size = sizeof(page) - sizeof(int);
+
+                    searchResult = read_dir(&path, &cursor, page + sizeof(int), &size, List);
+                    List = freeItemsList(List, unlockInumberItem);
+
+                    memcpy(page, &cursor, sizeof(int));
+                    schedReplyData(&request, searchResult, page, searchResult == FAIL ? 0 : sizeof(int) + size);
+                    break;
+                }
+                case 'f': {
+                    /* f <path> [pattern [f|d]] */
+                    char pattern[MAX_FILE_NAME + 1] = "", typeFilter[2] = "";
+                    findReply reply;
+
+                    sscanf(request.message, "%*c %*s " NAME_FORMAT " %1s", pattern, typeFilter);
+                    reply.used = 0;
+
+                    searchResult = find(&path, pattern, typeFilter[0] == 'f' ? T_FILE : typeFilter[0] == 'd' ? T_DIRECTORY : T_NONE,
+                            findCollect, &reply, List);
+                    List = freeItemsList(List, unlockInumberItem);
+
+                    findSend(&request, &reply, searchResult);
+                    break;
+                }
+                case 'w': {
+                    /* w <path> [r] watches a directory (r: everything under it), w <path> - stops */
+                    node_stat st;
+
+                    if (numTokens == 3 && typeAndName[0] == '-') {
+                        searchResult = watchUnsubscribe(name, &request.client, request.clientLen);
+                    } else {
+                        searchResult = stat_node(&path, &st, List);
+                        List = freeItemsList(List, unlockInumberItem);
+
+                        if (searchResult != FAIL && st.type != T_DIRECTORY)
+                            searchResult = FAIL;
+                        if (searchResult != FAIL)
+                            searchResult = watchSubscribe(name, numTokens == 3 && typeAndName[0] == 'r',
+                                    &request.client, request.clientLen);
+                    }
+                    schedReply(&request, searchResult);
+                    break;
+                }
+                case 'g': {
+                    /* the size, then the contents or a memfd holding them */
+                    readReply reply = { -1 };
+
+                    searchResult = read_file(&path, readContents, &reply, List);
+                    List = freeItemsList(List, unlockInumberItem);
+
+                    if (reply.fd >= 0) {
+                        schedReplyFd(&request, searchResult, reply.fd);
+                        close(reply.fd);
+                    } else {
+                        schedReplyData(&request, searchResult, reply.page, searchResult == FAIL ? 0 : searchResult);
+                    }
                     break;
+                }
+                case 'u': {
+                    /* the contents come in a sealed memfd */
+                    size_t size;
+                    char *contents = request.fd < 0 ? NULL : mapSharedFile(request.fd, &size);
+
+                    if (contents != NULL && size < FILE_MAX_SIZE) {
+                        startingModifyingCommand();
+
+                        searchResult = write_file(&path, contents, size, List);
+
+                        finishingModifyingCommand();
+                        List = freeItemsList(List, unlockInumberItem);
+                        leaseRevoke(name);
+                    }
+                    if (contents != NULL)
+                        unmapSharedFile(contents, size);
+                    schedReply(&request, searchResult);
+                    break;
+                }
+                case 'i': {
+                    /* i <path> l also asks for a lease, answered after the metadata */
+                    struct { node_stat st; int lease; } reply = { { 0 }, 0 };
+
+                    if (numTokens == 3 && typeAndName[0] == 'l')
+                        reply.lease = leaseGrant(name, LEASE_LOOKUP | LEASE_STAT, &request.client, request.clientLen);
+
+                    searchResult = stat_node(&path, &reply.st, List);
+                    List = freeItemsList(List, unlockInumberItem);
+                    if (numTokens == 3)
+                        schedReplyData(&request, searchResult, &reply, sizeof(reply));
+                    else
+                        schedReplyData(&request, searchResult, &reply.st, searchResult == FAIL ? 0 : sizeof(reply.st));
+                    break;
+                }
                 case 'd':
 
                     startingModifyingCommand();
 
-                    searchResult = delete(name, List);
+                    /* d <path> r deletes everything under it too */
+                    searchResult = delete(&path, numTokens == 3 && typeAndName[0] == 'r', List);
 
                     finishingModifyingCommand();
-
-                    List = freeItemsList(List, unlockItem);
-                    sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                           
+                    List = freeItemsList(List, unlockInumberItem);
+                    leaseRevoke(name);
+                    schedReply(&request, searchResult);
                     break;
 
                 case 'm':
+                    /* m <from> <to>, nothing to parse without the destination */
+                    if (numTokens != 3) {
+                        schedReply(&request, searchResult);
+                        break;
+                    }
 
                     startingModifyingCommand();
 
-                    searchResult = move(name, typeAndName, List);
+                    path_parse(&destination, typeAndName);
+                    searchResult = move(&path, &destination, List);
 
                     finishingModifyingCommand();
-                    List = freeItemsList(List, unlockItem);
-                    sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                         
+                    List = freeItemsList(List, unlockInumberItem);
+                    leaseRevoke(name);
+                    leaseRevoke(typeAndName);
+                    schedReply(&request, searchResult);
                     break;
 
                 case 'p':
@@ -174,16 +484,66 @@ void applyCommands(list* List){
                     }
 
                     finishingQuiescenteCommand();
-                    sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                            
+                    schedReply(&request, searchResult);
+                    break;
+
+                case 'y':
+                    /* y <from> <to>, nothing to parse without the destination */
+                    if (numTokens != 3) {
+                        schedReply(&request, searchResult);
+                        break;
+                    }
+
+                    startingModifyingCommand();
+
+                    path_parse(&destination, typeAndName);
+                    searchResult = copy(&path, &destination, List);
+
+                    finishingModifyingCommand();
+                    List = freeItemsList(List, unlockInumberItem);
+                    leaseRevoke(typeAndName);
+                    schedReply(&request, searchResult);
+                    break;
+
+                case 's': {
+                    FILE *statsOutput = openFile(name, "w");
+
+                    searchResult = SUCCESS;
+
+                    if(statsOutput == NULL)
+                        searchResult = FAIL;
+                    else{
+                        statsPrint(statsOutput);
+                        slabPrint(statsOutput);
+                        schedPrint(statsOutput);
+                        watchPrint(statsOutput);
+                        leasePrint(statsOutput);
+                        contentionPrint(statsOutput, numTokens == 3 ? atoi(typeAndName) : CONTENTION_DEFAULT_TOP);
+                        if(closeFile(statsOutput) == NULL)
+                            searchResult = FAIL;
+                    }
+
+                    schedReply(&request, searchResult);
+                    break;
+                }
+
+                case 'n':
+                    searchResult = poolSetBounds(atoi(name), numTokens == 3 ? atoi(typeAndName) : atoi(name));
+                    logMessage(LOG_INFO, "pool bounds set to %s %s: %s\n", name,
+                            numTokens == 3 ? typeAndName : name, searchResult == FAIL ? "invalid" : "ok");
+                    schedReply(&request, searchResult);
                     break;
                     
                 default: { /* error */
                     searchResult = FAIL;
-                    sendto(sockfd, (void*)&searchResult, sizeof(&searchResult), 0, (struct sockaddr *)&client_addr, addrlen);                           
+                    schedReply(&request, searchResult);
                     errorParse("Error: command to apply\n");
                     break;
                 }
             }
+
+            statsRecordOp(statsOpFromToken(token), searchResult, statsNow() - serviceStart);
+            poolWorkerIdle();
     }
 }
 
@@ -196,6 +556,8 @@ void *fnThread(void* arg){
 
     /* Free List */
     freeList(inodeList);
+    slabThreadFlush();
+    logThreadExit();
 
     return NULL;
 }
@@ -214,16 +576,80 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) {
 
 /*  Argv:
         1 -> numThread
-        2 -> nameServer */
-void setInitialValues(char *argv[]){
-    numberThreads = getNumberThreads(argv[1]);
-    sprintf(nameServer, "/tmp/%s", argv[2]);
+        2 -> nameServer
+    Options:
+        -a -> pin each thread to a CPU, filling one NUMA node at a time
+        -c -> track the contention on the inode locks
+        -k -> release the ancestors of a node once it is locked
+        -l level -> log level (debug, info, warn or error)
+        -s N -> log one of every N messages below error
+        -m min -> fewest threads the pool shrinks to (numThreads by default)
+        -M max -> most threads the pool grows to (numThreads by default)
+        -i N -> requests a client can have queued or being served
+        -g policy -> who goes first between print and modifying commands:
+                     print (default), modify, phase (take turns) or fifo
+        -w -> inode locks let waiting writers in before new readers
+        -u -> read the socket through an io_uring (recvmmsg if unavailable) */
+void setInitialValues(int argc, char *argv[]){
+    int opt, level;
+
+    while((opt = getopt(argc, argv, "ackl:s:m:M:i:g:wu")) != -1){
+        switch(opt){
+            case 'a':
+                setThreadPinning(1);
+                break;
+            case 'c':
+                contentionEnable();
+                break;
+            case 'k':
+                set_lock_coupling(1);
+                break;
+            case 'l':
+                if((level = logParseLevel(optarg)) == -1)
+                    errorParse("Error: unknown log level\n");
+                logSetLevel(level);
+                break;
+            case 's':
+                logSetSampling(atoi(optarg));
+                break;
+            case 'm':
+                minThreads = atoi(optarg);
+                break;
+            case 'M':
+                maxThreads = atoi(optarg);
+                break;
+            case 'i':
+                inflightLimit = atoi(optarg);
+                break;
+            case 'g':
+                if((gatePolicy = parseGatePolicy(optarg)) == -1)
+                    errorParse("Error: unknown gate policy\n");
+                break;
+            case 'w':
+                setLockPreferWriters(1);
+                break;
+            case 'u':
+                schedUseUring(1);
+                break;
+            default:
+                errorParse(USAGE);
+        }
+    }
+
+    if(argc - optind != 2)
+        errorParse(USAGE);
+
+    numberThreads = getNumberThreads(argv[optind]);
+    sprintf(nameServer, "/tmp/%s", argv[optind + 1]);
+
+    if (poolSetBounds(minThreads ? minThreads : numberThreads, maxThreads ? maxThreads : numberThreads))
+        errorParse("Error: invalid pool bounds\n");
 }
 
 int main(int argc, char* argv[]) {
     
     /* Define Arguments */
-    setInitialValues(argv);
+    setInitialValues(argc, argv);
 
     if (numberThreads <= 0)
         /* Error Handling */
@@ -249,13 +675,43 @@ int main(int argc, char* argv[]) {
         perror("server:: can't change permission of socket\n");
     }
     
+    /* only this thread handles SIGTERM and SIGINT, the pool inherits the mask */
+    sigset_t stopSignals;
+    int stopSignal;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGINT);
+    if (pthread_sigmask(SIG_BLOCK, &stopSignals, NULL))
+        errorParse("Error while blocking signals\n");
+    
     /* init filesystem */
     init_fs();
+    logInit();
+
+    /* one thread reads the socket, the pool serves the clients in turns */
+    schedInit(sockfd, inflightLimit);
+    schedStart();
+    watchInit(sockfd);
+    leaseInit(sockfd);
 
     /*creates pool of threads and process input and print tree */
-    poolThreads(numberThreads, fnThread);
+    poolStart(numberThreads, fnThread);
+
+    if (sigwait(&stopSignals, &stopSignal))
+        errorParse("Error while waiting for signals\n");
+
+    /* drain: the threads finish what was already sent, then leave */
+    logMessage(LOG_INFO, "stopping on signal %d\n", stopSignal);
+    poolStop();
+    schedStop();
+    poolJoin();
+    schedDestroy();
+    watchDestroy();
 
     /* release allocated memory */
+    logDestroy();
     destroy_fs();
+    close(sockfd);
+    unlink(path);
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,76 @@
+#!/bin/bash
+
+# Runs the client on each input of inputs/ that has what it must print in
+# outputs/client/, each on a new server, and compares the two.
+# usage: ./runClientTests.sh [numThreads] [server options]
+# The tree printed by a p command is compared too, after the output of the
+# client. The socket and the times given by stat change every run, so
+# they are left out. Also checks contents of every size are read back
+# byte for byte (see contents-check.c).
+
+THREADS=${1:-4}
+shift 1 2>/dev/null
+
+CLIENT_DIR=./so-20-21-ex3_base/client
+SERVER=tfsTests$$
+# short, the paths of the commands go in a request
+OUT=$(mktemp -d /tmp/tfsXXXX)
+FAILED=0
+
+if [[ ! -x ./tecnicofs || ! -x $CLIENT_DIR/tecnicofs-client ]]
+then
+    echo "Build the server and the client first"
+    exit 1
+fi
+
+startServer(){
+    ./tecnicofs $THREADS $SERVER "$@" > $OUT/server.log 2>&1 &
+    server=$!
+    sleep 0.3
+}
+
+stopServer(){
+    kill $server
+    wait $server 2>/dev/null
+}
+
+for expected in outputs/client/*.txt; do
+    name=$(basename $expected)
+
+    # the tree goes to a file of our own, not to the one in outputs/
+    sed "s#^p .*#p $OUT/tree.txt#" inputs/$name > $OUT/input.txt
+    rm -f $OUT/tree.txt
+
+    startServer "$@"
+    $CLIENT_DIR/tecnicofs-client $OUT/input.txt $SERVER > $OUT/output.txt 2>&1
+    stopServer
+
+    [[ -f $OUT/tree.txt ]] && cat $OUT/tree.txt >> $OUT/output.txt
+    sed -i -e 's/socket = [^)]*/socket = S/' -e 's/mtime=[0-9]*/mtime=T/' -e 's/ctime=[0-9]*/ctime=T/' $OUT/output.txt
+
+    if diff $expected $OUT/output.txt > $OUT/diff.txt
+    then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        cat $OUT/diff.txt
+        FAILED=1
+    fi
+done
+
+gcc -pthread -std=gnu99 -fcommon -I./so-20-21-ex3_base -o $OUT/contents-check \
+    $CLIENT_DIR/contents-check.c $CLIENT_DIR/tecnicofs-client-api.c || exit 1
+
+startServer "$@"
+if $OUT/contents-check $SERVER > $OUT/output.txt
+then
+    echo "PASS contents"
+else
+    echo "FAIL contents"
+    cat $OUT/output.txt
+    FAILED=1
+fi
+stopServer
+
+rm -rf $OUT
+exit $FAILED
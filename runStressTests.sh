@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# Latency of commands on shallow paths while other clients keep walking a
+# deep path, with and without -k (hand-over-hand locking).
+# usage: ./runStressTests.sh [numThreads] [deepClients] [server options]
+# The inputs are in inputs/stress: setup.txt builds /a/b/c/d/e/x and /a/q,
+# each deep client runs deep.txt (lookups of /a/b/c/d/e/x) over and over,
+# and one client runs shallow.txt once: files created in /a, moved to /a/q
+# and back (write locking /a) and deleted.
+# Prints the time the shallow client took and, from the stats of the server
+# (started with -c), how the locks of depth 1 (/a) were waited for and held.
+
+THREADS=${1:-4}
+DEEP=${2:-3}
+shift 2 2>/dev/null
+
+CLIENT=./so-20-21-ex3_base/client/tecnicofs-client
+INPUTS=inputs/stress
+SERVER=tfsStress$$
+# short, the paths of the commands go in a request
+OUT=$(mktemp -d /tmp/tfsXXXX)
+
+if [[ ! -x ./tecnicofs || ! -x $CLIENT ]]
+then
+    echo "Build the server and the client first"
+    exit 1
+fi
+
+run(){
+    ./tecnicofs $THREADS $SERVER -c "$@" > $OUT/server.log 2>&1 &
+    server=$!
+    sleep 0.3
+
+    $CLIENT $INPUTS/setup.txt $SERVER > /dev/null
+
+    rm -f $OUT/stop
+    deep=()
+    for i in $(seq 1 $DEEP); do
+        ( while [[ ! -f $OUT/stop ]]; do $CLIENT $INPUTS/deep.txt $SERVER > /dev/null; done ) &
+        deep+=($!)
+    done
+    sleep 0.5
+
+    start=$(date +%s%N)
+    $CLIENT $INPUTS/shallow.txt $SERVER > $OUT/shallow.txt
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+
+    touch $OUT/stop
+    wait ${deep[@]}
+
+    echo "s $OUT/stats.txt" > $OUT/stats.in
+    $CLIENT $OUT/stats.in $SERVER > /dev/null
+
+    kill $server
+    wait $server 2>/dev/null
+
+    echo "options=[$*] shallow_ms=$elapsed $(grep -c Unable $OUT/shallow.txt) failed"
+    grep "^depth 1 " $OUT/stats.txt
+}
+
+run "$@"
+run -k "$@"
+
+rm -rf $OUT
@@ -0,0 +1,655 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "../er/error.h"
+#include "../lg/logging.h"
+#include "../ur/uring.h"
+#include "../sts/stats.h"
+#include "../fs/state.h"
+#include "../tecnicofs-api-constants.h"
+
+/*
+ * A client with requests queued or being served, or seen recently.
+ * Its turn serves up to weight of its requests before moving on.
+ */
+typedef struct schedClient {
+    int inUse;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    unsigned int hash;
+    int weight;
+    int credit;
+    /* queued or being served, only lowered outside schedLock */
+    int inflight;
+    int head;
+    int count;
+    schedRequest queue[SCHED_CLIENT_QUEUE];
+    unsigned long served;
+    unsigned long rejected;
+} schedClient;
+
+/* Everything below is changed with schedLock held, except where noted */
+static pthread_mutex_t schedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t schedReady = PTHREAD_COND_INITIALIZER;
+static schedClient clients[SCHED_MAX_CLIENTS];
+/* client whose turn it is */
+static int cursor = 0;
+static int queued = 0;
+/* the receiver may still queue requests */
+static int receiving = 0;
+static int stopping = 0;
+
+static int sock = -1;
+static int inflightLimit = SCHED_DEFAULT_INFLIGHT;
+static pthread_t receiverThread;
+/* read the socket through an io_uring, set before schedStart */
+static int useUring = 0;
+
+static unsigned long received = 0;
+/* reads of the socket that got requests */
+static unsigned long batches = 0;
+static unsigned long rejectedLimit = 0;
+static unsigned long rejectedFull = 0;
+static unsigned long long waitSum = 0;
+static unsigned long long waitMax = 0;
+
+static void schedLockMutex(){
+    if (pthread_mutex_lock(&schedLock))
+        errorParse("Error while locking the scheduler\n");
+}
+
+static void schedUnlockMutex(){
+    if (pthread_mutex_unlock(&schedLock))
+        errorParse("Error while unlocking the scheduler\n");
+}
+
+static unsigned int pathHash(char *path){
+    unsigned int hash = 2166136261u;
+
+    for (; *path; path++)
+        hash = (hash ^ (unsigned char) *path) * 16777619u;
+
+    return hash;
+}
+
+/* Closes the descriptor passed with a request, if any */
+static void closeRequestFd(schedRequest *request){
+    if (request->fd >= 0)
+        close(request->fd);
+    request->fd = -1;
+}
+
+/*
+ * Sends an answer, with a descriptor when fd isn't -1.
+ * Returns: SUCCESS or FAIL if the client can't be reached
+ */
+static int sendReply(schedRequest *request, int result, void *data, size_t size, int fd){
+    struct iovec parts[2] = { { &result, sizeof(result) }, { data, size } };
+    struct msghdr message = { 0 };
+    char control[CMSG_SPACE(sizeof(int))];
+
+    message.msg_name = &request->client;
+    message.msg_namelen = request->clientLen;
+    message.msg_iov = parts;
+    message.msg_iovlen = size ? 2 : 1;
+
+    if (fd >= 0) {
+        struct cmsghdr *header;
+
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+
+    return sendmsg(sock, &message, 0) < 0 ? FAIL : SUCCESS;
+}
+
+/* Returns the descriptor passed with a message, -1 if none */
+static int receivedFd(struct msghdr *message){
+    int fd = -1;
+
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(message); header; header = CMSG_NXTHDR(message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS && fd < 0)
+            memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    }
+    return fd;
+}
+
+/*
+ * Finds the slot of a client, with schedLock held. New clients take a
+ * free slot, or the one of a client with nothing in flight.
+ * Returns: the slot or FAIL if every client has requests in flight
+ */
+static int findClient(char *path){
+    unsigned int hash = pathHash(path);
+    int idle = FAIL;
+
+    for (int slot = 0; slot < SCHED_MAX_CLIENTS; slot++) {
+        schedClient *client = &clients[slot];
+
+        if (!client->inUse) {
+            if (idle == FAIL || clients[idle].inUse)
+                idle = slot;
+            continue;
+        }
+        if (client->hash == hash && !strcmp(client->path, path))
+            return slot;
+        if (idle == FAIL && __atomic_load_n(&client->inflight, __ATOMIC_ACQUIRE) == 0)
+            idle = slot;
+    }
+
+    if (idle != FAIL) {
+        schedClient *client = &clients[idle];
+
+        client->inUse = 1;
+        strcpy(client->path, path);
+        client->hash = hash;
+        client->weight = 1;
+        client->credit = 0;
+        client->head = 0;
+        client->count = 0;
+        client->served = 0;
+        client->rejected = 0;
+    }
+    return idle;
+}
+
+/*
+ * Queues a request in the queue of its client, with schedLock held, or
+ * refuses it with TECNICOFS_ERROR_BUSY when the client has too many in
+ * flight or the server too many queued. The weight command (q) is
+ * answered here.
+ * Returns: 1 if it was queued, else 0 and the answer is stored in answer
+ */
+static int schedQueue(schedRequest *request, int *answer){
+    schedClient *client;
+    int slot, weight;
+
+    received++;
+
+    slot = findClient(request->client.sun_path);
+    if (slot == FAIL || queued >= SCHED_MAX_QUEUED) {
+        rejectedFull++;
+        *answer = TECNICOFS_ERROR_BUSY;
+        return 0;
+    }
+    client = &clients[slot];
+
+    if (request->message[0] == 'q') {
+        weight = atoi(request->message + 1);
+        if (weight >= 1 && weight <= SCHED_MAX_WEIGHT)
+            client->weight = weight;
+        *answer = weight >= 1 && weight <= SCHED_MAX_WEIGHT ? SUCCESS : FAIL;
+        return 0;
+    }
+
+    if (__atomic_load_n(&client->inflight, __ATOMIC_ACQUIRE) >= inflightLimit) {
+        client->rejected++;
+        rejectedLimit++;
+        *answer = TECNICOFS_ERROR_BUSY;
+        return 0;
+    }
+
+    request->slot = slot;
+    client->queue[(client->head + client->count) % SCHED_CLIENT_QUEUE] = *request;
+    client->count++;
+    __atomic_fetch_add(&client->inflight, 1, __ATOMIC_RELEASE);
+    queued++;
+
+    return 1;
+}
+
+/*
+ * Queues the requests read together, taking schedLock and waking the
+ * workers once, and answers the ones not queued with a single sendmmsg.
+ */
+static void schedQueueBatch(schedRequest *requests, int count){
+    struct mmsghdr answers[SCHED_RECV_BATCH];
+    struct iovec parts[SCHED_RECV_BATCH];
+    int results[SCHED_RECV_BATCH];
+    int added = 0, refused = 0;
+
+    schedLockMutex();
+    batches++;
+
+    for (int i = 0; i < count; i++) {
+        schedRequest *request = &requests[i];
+
+        if (schedQueue(request, &results[refused])) {
+            added++;
+            continue;
+        }
+
+        closeRequestFd(request);
+        parts[refused].iov_base = &results[refused];
+        parts[refused].iov_len = sizeof(int);
+        memset(&answers[refused], 0, sizeof(answers[refused]));
+        answers[refused].msg_hdr.msg_name = &request->client;
+        answers[refused].msg_hdr.msg_namelen = request->clientLen;
+        answers[refused].msg_hdr.msg_iov = &parts[refused];
+        answers[refused].msg_hdr.msg_iovlen = 1;
+        refused++;
+    }
+
+    if ((added == 1 && pthread_cond_signal(&schedReady)) || (added > 1 && pthread_cond_broadcast(&schedReady)))
+        errorParse("Error while signaling the scheduler\n");
+    schedUnlockMutex();
+
+    /* never wait for a client that doesn't read its answers */
+    if (refused)
+        sendmmsg(sock, answers, refused, MSG_DONTWAIT);
+}
+
+/*
+ * Completes a request read from the socket, of c bytes.
+ * Returns: 1, or 0 if it isn't one to serve (its descriptor closed)
+ */
+static int takeRequest(schedRequest *request, struct msghdr *header, int c){
+    request->clientLen = header->msg_namelen;
+    request->fd = receivedFd(header);
+
+    /* woken up to stop, or the mount handshake, sent before the
+       client has an address to answer to */
+    if (c == 0 || request->message[0] == 't' || request->clientLen <= sizeof(sa_family_t)) {
+        closeRequestFd(request);
+        return 0;
+    }
+    request->message[c] = '\0';
+    request->arrival = statsNow();
+    return 1;
+}
+
+/* Queues a read of the socket into a slot of the receiver's io_uring */
+static void armReceive(uring *ring, int slot, schedRequest *request, struct msghdr *header,
+        struct iovec *part, char *control){
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+
+    memset(header, 0, sizeof(*header));
+    header->msg_name = &request->client;
+    header->msg_namelen = sizeof(request->client);
+    part->iov_base = request->message;
+    part->iov_len = sizeof(request->message) - 1;
+    header->msg_iov = part;
+    header->msg_iovlen = 1;
+    header->msg_control = control;
+    header->msg_controllen = CMSG_SPACE(sizeof(int));
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock;
+    sqe->addr = (unsigned long) header;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_CMSG_CLOEXEC;
+    sqe->user_data = slot;
+}
+
+/*
+ * Reads the requests through an io_uring until stopping: SCHED_RECV_BATCH
+ * reads of the socket are kept queued in the kernel, and a single
+ * io_uring_enter both queues again the ones done and waits for more.
+ * Once stopping, the reads left are cancelled one by one (cancelling every
+ * read of the socket at once needs Linux 5.19), keeping what they read.
+ * A kernel that can't cancel them gets the socket shut down for reading
+ * instead, which ends them once nothing is left to read.
+ */
+static void uringReceive(uring *ring){
+    static schedRequest slots[SCHED_RECV_BATCH];
+    static struct msghdr headers[SCHED_RECV_BATCH];
+    static struct iovec parts[SCHED_RECV_BATCH];
+    static char controls[SCHED_RECV_BATCH][CMSG_SPACE(sizeof(int))];
+    schedRequest requests[SCHED_RECV_BATCH];
+    int pending[SCHED_RECV_BATCH];
+    int armed = 0, cancelled = 0;
+
+    for (int slot = 0; slot < SCHED_RECV_BATCH; slot++, armed++) {
+        armReceive(ring, slot, &slots[slot], &headers[slot], &parts[slot], controls[slot]);
+        pending[slot] = 1;
+    }
+
+    while (armed > 0) {
+        struct io_uring_cqe *cqe;
+        int stop, count = 0;
+
+        if (uringSubmit(ring, 1) < 0 && errno != EINTR)
+            errorParse("Error while waiting on the io_uring\n");
+
+        stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+
+        while ((cqe = uringPeekCqe(ring)) != NULL) {
+            unsigned long slot = cqe->user_data;
+            int c = cqe->res;
+
+            uringSeenCqe(ring);
+            /* a cancel, the read is gone or about to be unless it failed */
+            if (slot >= SCHED_RECV_BATCH) {
+                if (c < 0 && c != -ENOENT && c != -EALREADY)
+                    shutdown(sock, SHUT_RD);
+                continue;
+            }
+            armed--;
+            pending[slot] = 0;
+
+            if (c >= 0 && takeRequest(&slots[slot], &headers[slot], c))
+                requests[count++] = slots[slot];
+            if (!stop) {
+                armReceive(ring, slot, &slots[slot], &headers[slot], &parts[slot], controls[slot]);
+                armed++;
+                pending[slot] = 1;
+            }
+        }
+
+        if (count)
+            schedQueueBatch(requests, count);
+
+        if (stop && armed > 0 && !cancelled) {
+            for (int slot = 0; slot < SCHED_RECV_BATCH; slot++) {
+                struct io_uring_sqe *sqe;
+
+                if (!pending[slot])
+                    continue;
+                sqe = uringGetSqe(ring);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = slot;
+                sqe->user_data = SCHED_RECV_BATCH + slot;
+            }
+            cancelled = 1;
+        }
+    }
+}
+
+/*
+ * Reads every request from the socket into the queues, up to
+ * SCHED_RECV_BATCH of them in a single recvmmsg: it waits for the first
+ * one and takes the others already sent, unless it reads through an
+ * io_uring. Once stopping, it only reads what was already sent, then
+ * returns.
+ */
+static void *receiverLoop(void *arg){
+    static schedRequest requests[SCHED_RECV_BATCH];
+    static struct mmsghdr messages[SCHED_RECV_BATCH];
+    static struct iovec parts[SCHED_RECV_BATCH];
+    static char controls[SCHED_RECV_BATCH][CMSG_SPACE(sizeof(int))];
+    uring *ring = arg;
+
+    if (ring != NULL) {
+        uringReceive(ring);
+        uringDestroy(ring);
+    }
+
+    for (int i = 0; i < SCHED_RECV_BATCH; i++) {
+        parts[i].iov_base = requests[i].message;
+        parts[i].iov_len = sizeof(requests[i].message) - 1;
+    }
+
+    while (1) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        int count, kept = 0;
+
+        for (int i = 0; i < SCHED_RECV_BATCH; i++) {
+            memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_name = &requests[i].client;
+            messages[i].msg_hdr.msg_namelen = sizeof(requests[i].client);
+            messages[i].msg_hdr.msg_iov = &parts[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = controls[i];
+            messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+
+        count = recvmmsg(sock, messages, SCHED_RECV_BATCH,
+                MSG_CMSG_CLOEXEC | (stop ? MSG_DONTWAIT : MSG_WAITFORONE), NULL);
+
+        if (count < 0 && stop)
+            break;
+        if (count < 0)
+            continue;
+
+        for (int i = 0; i < count; i++) {
+            schedRequest *request = &requests[kept];
+            int c = messages[i].msg_len;
+
+            /* keep the requests together at the front */
+            if (kept != i) {
+                memcpy(request->message, requests[i].message, c);
+                request->client = requests[i].client;
+            }
+            kept += takeRequest(request, &messages[i].msg_hdr, c);
+        }
+
+        if (kept)
+            schedQueueBatch(requests, kept);
+    }
+
+    schedLockMutex();
+    receiving = 0;
+    if (pthread_cond_broadcast(&schedReady))
+        errorParse("Error while broadcasting the scheduler\n");
+    schedUnlockMutex();
+
+    return NULL;
+}
+
+
+/*
+ * Sets up the scheduler of the requests read from a socket.
+ * Input:
+ *  - sockfd: the socket of the server
+ *  - limit: requests a client can have queued or being served
+ */
+void schedInit(int sockfd, int limit){
+    if (limit < 1 || limit > SCHED_CLIENT_QUEUE)
+        errorParse("Error: invalid in-flight limit\n");
+
+    sock = sockfd;
+    inflightLimit = limit;
+}
+
+/*
+ * Makes the receiver read the socket through an io_uring, falling back
+ * to recvmmsg if the kernel doesn't allow it. Called before schedStart.
+ * Input:
+ *  - enable: read through an io_uring
+ */
+void schedUseUring(int enable){
+    useUring = enable;
+}
+
+/*
+ * Starts the thread that reads the socket.
+ */
+void schedStart(){
+    static uring ring;
+
+    if (useUring && uringInit(&ring, 2 * SCHED_RECV_BATCH) == FAIL) {
+        logMessage(LOG_WARN, "io_uring unavailable (%s), reading with recvmmsg\n", strerror(errno));
+        useUring = 0;
+    }
+
+    receiving = 1;
+    if (pthread_create(&receiverThread, NULL, receiverLoop, useUring ? &ring : NULL) != 0)
+        errorParse("Error while creating the receiver thread.\n");
+}
+
+/*
+ * Takes the next request to serve. Clients take turns, each serving up
+ * to its weight of requests (weighted round robin), so a client sending
+ * many requests doesn't delay the others.
+ * Input:
+ *  - request: where to store the request
+ *  - timeoutMs: how long to wait for one
+ * Returns: SUCCESS, SCHED_TIMEOUT if none came in time, or FAIL once the
+ *  receiver stopped and there are none left
+ */
+int schedTake(schedRequest *request, int timeoutMs){
+    struct timespec deadline;
+    long long waited;
+    int result;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    schedLockMutex();
+    while (queued == 0 && receiving) {
+        result = pthread_cond_timedwait(&schedReady, &schedLock, &deadline);
+        if (result == ETIMEDOUT)
+            break;
+        if (result)
+            errorParse("Error while waiting for requests\n");
+    }
+
+    if (queued == 0) {
+        result = receiving ? SCHED_TIMEOUT : FAIL;
+        schedUnlockMutex();
+        return result;
+    }
+
+    for (int i = 0; i < SCHED_MAX_CLIENTS; i++) {
+        int slot = (cursor + i) % SCHED_MAX_CLIENTS;
+        schedClient *client = &clients[slot];
+
+        if (client->count == 0)
+            continue;
+
+        /* a new turn */
+        if (i > 0 || client->credit == 0)
+            client->credit = client->weight;
+
+        *request = client->queue[client->head];
+        client->head = (client->head + 1) % SCHED_CLIENT_QUEUE;
+        client->count--;
+        client->credit--;
+        queued--;
+
+        cursor = client->credit > 0 && client->count > 0 ? slot : (slot + 1) % SCHED_MAX_CLIENTS;
+        break;
+    }
+
+    waited = statsNow() - request->arrival;
+    waitSum += waited;
+    if (waited > waitMax)
+        waitMax = waited;
+    schedUnlockMutex();
+
+    return SUCCESS;
+}
+
+/*
+ * Answers a request taken by schedTake. The client may send its next
+ * request as soon as it gets the answer, so it stops counting as in
+ * flight before that.
+ * Input:
+ *  - request: the request
+ *  - result: what to answer
+ */
+void schedReply(schedRequest *request, int result){
+    schedReplyData(request, result, NULL, 0);
+}
+
+/*
+ * Answers a request taken by schedTake with the result followed by data.
+ * Input:
+ *  - request: the request
+ *  - result: what to answer
+ *  - data: sent right after the result
+ *  - size: size of data
+ */
+void schedReplyData(schedRequest *request, int result, void *data, size_t size){
+    closeRequestFd(request);
+    __atomic_fetch_add(&clients[request->slot].served, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&clients[request->slot].inflight, 1, __ATOMIC_RELEASE);
+
+    sendReply(request, result, data, size, -1);
+}
+
+/*
+ * Answers a request taken by schedTake with the result and a descriptor
+ * (SCM_RIGHTS), which the client gets a copy of.
+ * Input:
+ *  - request: the request
+ *  - result: what to answer
+ *  - fd: the descriptor
+ */
+void schedReplyFd(schedRequest *request, int result, int fd){
+    closeRequestFd(request);
+    __atomic_fetch_add(&clients[request->slot].served, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&clients[request->slot].inflight, 1, __ATOMIC_RELEASE);
+
+    sendReply(request, result, NULL, 0, fd);
+}
+
+/*
+ * Sends part of a long answer to a request, in a datagram of its own,
+ * before the last part is sent with schedReplyData.
+ * Input:
+ *  - request: the request
+ *  - result: what to answer
+ *  - data: sent right after the result
+ *  - size: size of data
+ * Returns: SUCCESS or FAIL if the client can't be reached
+ */
+int schedSendData(schedRequest *request, int result, void *data, size_t size){
+    return sendReply(request, result, data, size, -1);
+}
+
+/*
+ * Makes the receiver read what was already sent and stop. schedTake
+ * keeps giving the queued requests, then fails without waiting.
+ */
+void schedStop(){
+    struct sockaddr_un self;
+    socklen_t selfLen = sizeof(self);
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+
+    /* wake the receiver up */
+    if (getsockname(sock, (struct sockaddr *) &self, &selfLen) == 0)
+        sendto(sock, "", 0, 0, (struct sockaddr *) &self, selfLen);
+}
+
+/*
+ * Waits for the receiver to stop.
+ */
+void schedDestroy(){
+    if (pthread_join(receiverThread, NULL))
+        errorParse("Error while joining the receiver thread\n");
+}
+
+/*
+ * Prints the requests received and refused, and each known client.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void schedPrint(FILE *fp){
+    schedLockMutex();
+
+    fprintf(fp, "# scheduler%s\n", useUring ? " (io_uring)" : "");
+    fprintf(fp, "received=%lu in %lu reads (%.2f per read) refused=%lu (client limit %d) refused=%lu (server full) queued=%d wait=%lluns maxwait=%lluns\n",
+            received, batches, batches ? (double) received / batches : 0.0, rejectedLimit, inflightLimit,
+            rejectedFull, queued, waitSum, waitMax);
+
+    for (int slot = 0; slot < SCHED_MAX_CLIENTS; slot++) {
+        schedClient *client = &clients[slot];
+
+        if (!client->inUse)
+            continue;
+        fprintf(fp, "client %s weight=%d inflight=%d served=%lu refused=%lu\n", client->path, client->weight,
+                __atomic_load_n(&client->inflight, __ATOMIC_RELAXED),
+                __atomic_load_n(&client->served, __ATOMIC_RELAXED), client->rejected);
+    }
+
+    schedUnlockMutex();
+}
@@ -0,0 +1,50 @@
+#ifndef SCH_H
+#define SCH_H
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Size of the messages read from clients, longer ones are cut */
+#define SCHED_MESSAGE_SIZE 30
+/* Clients with a queue of their own at the same time */
+#define SCHED_MAX_CLIENTS 64
+/* Requests a client can have queued, the in-flight limit can't be higher */
+#define SCHED_CLIENT_QUEUE 16
+/* Default requests a client can have queued or being served */
+#define SCHED_DEFAULT_INFLIGHT 4
+/* Requests queued over all clients before every new one is refused */
+#define SCHED_MAX_QUEUED 256
+/* Highest weight a client can ask for, the default is 1 */
+#define SCHED_MAX_WEIGHT 16
+/* Requests read from the socket in a single call */
+#define SCHED_RECV_BATCH 16
+/* Returned by schedTake when no request came in time, the receiver
+   still running (FAIL: it stopped and every request was taken) */
+#define SCHED_TIMEOUT 1
+
+/*
+ * A request read from the socket, with who sent it
+ */
+typedef struct schedRequest {
+    char message[SCHED_MESSAGE_SIZE];
+    struct sockaddr_un client;
+    socklen_t clientLen;
+    /* descriptor passed with it (SCM_RIGHTS) or -1, closed once answered */
+    int fd;
+    int slot;
+    long long arrival;
+} schedRequest;
+
+void schedInit(int sockfd, int inflightLimit);
+void schedUseUring(int enable);
+void schedStart();
+int schedTake(schedRequest *request, int timeoutMs);
+void schedReply(schedRequest *request, int result);
+void schedReplyData(schedRequest *request, int result, void *data, size_t size);
+int schedSendData(schedRequest *request, int result, void *data, size_t size);
+void schedReplyFd(schedRequest *request, int result, int fd);
+void schedStop();
+void schedDestroy();
+void schedPrint(FILE *fp);
+
+#endif
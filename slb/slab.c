@@ -0,0 +1,286 @@
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../er/error.h"
+#include "../sts/stats.h"
+#include "../thr/threads.h"
+
+/* Free blocks are chained through their first bytes */
+typedef struct freeBlock {
+    struct freeBlock *next;
+} freeBlock;
+
+/*
+ * Shared free blocks of one kind on one NUMA node, the only part that
+ * takes a lock. Chunks are carved by a thread of that node, so their
+ * pages are first touched (and placed) there.
+ */
+typedef struct slabDepot {
+    pthread_mutex_t lock;
+    size_t blockSize;
+    freeBlock *free;
+    unsigned long freeCount;
+    unsigned long chunks;
+    unsigned long transfers;
+} slabDepot;
+
+typedef struct slabMagazine {
+    int count;
+    void *blocks[SLAB_MAGAZINE];
+} slabMagazine;
+
+/*
+ * Free blocks cached by one thread, only touched by that thread
+ */
+typedef struct slabThread {
+    int inUse;
+    int node;
+    slabMagazine magazines[SLAB_KINDS];
+    unsigned long allocs[SLAB_KINDS];
+    unsigned long frees[SLAB_KINDS];
+} slabThread;
+
+static slabDepot depots[THREAD_MAX_NODES][SLAB_KINDS];
+static slabThread threads[SLAB_MAX_THREADS];
+static __thread slabThread *myThread = NULL;
+static long long startTime = 0;
+
+static const char *kindNames[SLAB_KINDS] = { "directory", "file" };
+
+static void depotLock(slabDepot *depot){
+    if (pthread_mutex_lock(&depot->lock))
+        errorParse("Error while locking slab depot\n");
+}
+
+static void depotUnlock(slabDepot *depot){
+    if (pthread_mutex_unlock(&depot->lock))
+        errorParse("Error while unlocking slab depot\n");
+}
+
+/* Carves a new chunk into free blocks, with the depot locked */
+static void depotGrow(slabDepot *depot){
+    char *chunk = malloc(depot->blockSize * SLAB_CHUNK);
+
+    if (chunk == NULL)
+        return;
+
+    for (int i = 0; i < SLAB_CHUNK; i++) {
+        freeBlock *block = (freeBlock*) (chunk + i * depot->blockSize);
+
+        block->next = depot->free;
+        depot->free = block;
+    }
+    depot->freeCount += SLAB_CHUNK;
+    depot->chunks++;
+}
+
+/* Moves up to count blocks from the depot into the magazine */
+static void depotTake(slabDepot *depot, slabMagazine *magazine, int count){
+    depotLock(depot);
+
+    if (depot->free == NULL)
+        depotGrow(depot);
+
+    while (count-- > 0 && depot->free != NULL) {
+        magazine->blocks[magazine->count++] = depot->free;
+        depot->free = depot->free->next;
+        depot->freeCount--;
+    }
+    depot->transfers++;
+
+    depotUnlock(depot);
+}
+
+/* Moves count blocks from the magazine back to the depot */
+static void depotGive(slabDepot *depot, slabMagazine *magazine, int count){
+    depotLock(depot);
+
+    while (count-- > 0 && magazine->count > 0) {
+        freeBlock *block = magazine->blocks[--magazine->count];
+
+        block->next = depot->free;
+        depot->free = block;
+        depot->freeCount++;
+    }
+    depot->transfers++;
+
+    depotUnlock(depot);
+}
+
+/* Returns the caches of the calling thread, NULL if there are none left */
+static slabThread *getMyThread(){
+    if (myThread != NULL)
+        return myThread;
+
+    for (int i = 0; i < SLAB_MAX_THREADS; i++) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(&threads[i].inUse, &expected, 1,
+                0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            myThread = &threads[i];
+            myThread->node = getThreadNode();
+            return myThread;
+        }
+    }
+    return NULL;
+}
+
+/* Resident set size of the process, in bytes */
+static long residentBytes(){
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+/*
+ * Sets up the depot of a kind of blocks. Must be called before the threads start.
+ * Input:
+ *  - kind: the kind of blocks
+ *  - blockSize: size of each block
+ */
+void slabInit(int kind, size_t blockSize){
+    if (blockSize < sizeof(freeBlock))
+        blockSize = sizeof(freeBlock);
+
+    for (int node = 0; node < THREAD_MAX_NODES; node++) {
+        slabDepot *depot = &depots[node][kind];
+
+        if (pthread_mutex_init(&depot->lock, NULL))
+            errorParse("Error while initing slab depot\n");
+
+        /* keep every block aligned */
+        depot->blockSize = (blockSize + 15) & ~(size_t) 15;
+    }
+
+    if (startTime == 0)
+        startTime = statsNow();
+}
+
+/*
+ * Allocates a block, from the cache of the calling thread when it has one
+ * or else from the depot of its NUMA node.
+ * Input:
+ *  - kind: the kind of blocks
+ * Returns: the block or NULL if out of memory
+ */
+void *slabAlloc(int kind){
+    slabThread *thread = getMyThread();
+    slabMagazine *magazine;
+
+    if (thread == NULL) {
+        slabMagazine single = { 0 };
+
+        depotTake(&depots[getThreadNode()][kind], &single, 1);
+        return single.count ? single.blocks[0] : NULL;
+    }
+
+    magazine = &thread->magazines[kind];
+    if (magazine->count == 0)
+        depotTake(&depots[thread->node][kind], magazine, SLAB_BATCH);
+    if (magazine->count == 0)
+        return NULL;
+
+    __atomic_store_n(&thread->allocs[kind], thread->allocs[kind] + 1, __ATOMIC_RELAXED);
+    return magazine->blocks[--magazine->count];
+}
+
+/*
+ * Frees a block into the cache of the calling thread, giving half of the
+ * cache back to the depot of its node when it is full. Blocks freed on
+ * another node than they were carved on stay there.
+ * Input:
+ *  - kind: the kind of blocks
+ *  - block: block returned by slabAlloc, or NULL
+ */
+void slabFree(int kind, void *block){
+    slabThread *thread;
+    slabMagazine *magazine;
+
+    if (block == NULL)
+        return;
+
+    thread = getMyThread();
+    if (thread == NULL) {
+        slabMagazine single = { 1, { block } };
+
+        depotGive(&depots[getThreadNode()][kind], &single, 1);
+        return;
+    }
+
+    magazine = &thread->magazines[kind];
+    if (magazine->count == SLAB_MAGAZINE)
+        depotGive(&depots[thread->node][kind], magazine, SLAB_BATCH);
+
+    magazine->blocks[magazine->count++] = block;
+    __atomic_store_n(&thread->frees[kind], thread->frees[kind] + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Gives the blocks cached by the calling thread back to the depot and
+ * releases its caches for other threads. Called when a thread finishes.
+ */
+void slabThreadFlush(){
+    if (myThread == NULL)
+        return;
+
+    for (int kind = 0; kind < SLAB_KINDS; kind++) {
+        if (myThread->magazines[kind].count && depots[myThread->node][kind].blockSize)
+            depotGive(&depots[myThread->node][kind], &myThread->magazines[kind], SLAB_MAGAZINE);
+    }
+
+    __atomic_store_n(&myThread->inUse, 0, __ATOMIC_RELEASE);
+    myThread = NULL;
+}
+
+/*
+ * Prints the allocation counters of each kind and the resident memory.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void slabPrint(FILE *fp){
+    double seconds = (statsNow() - startTime) / 1e9;
+
+    fprintf(fp, "# allocator\n");
+    for (int kind = 0; kind < SLAB_KINDS; kind++) {
+        size_t blockSize = depots[0][kind].blockSize;
+        unsigned long allocs = 0, frees = 0, chunks = 0, freeCount = 0, transfers = 0;
+
+        if (blockSize == 0)
+            continue;
+
+        for (int i = 0; i < SLAB_MAX_THREADS; i++) {
+            allocs += __atomic_load_n(&threads[i].allocs[kind], __ATOMIC_RELAXED);
+            frees += __atomic_load_n(&threads[i].frees[kind], __ATOMIC_RELAXED);
+        }
+
+        for (int node = 0; node < getNumberNodes(); node++) {
+            slabDepot *depot = &depots[node][kind];
+
+            depotLock(depot);
+            chunks += depot->chunks;
+            freeCount += depot->freeCount;
+            transfers += depot->transfers;
+            if (getNumberNodes() > 1)
+                fprintf(fp, "%-10s node=%d reserved=%luB depot=%lu\n", kindNames[kind], node,
+                        depot->chunks * SLAB_CHUNK * blockSize, depot->freeCount);
+            depotUnlock(depot);
+        }
+
+        fprintf(fp, "%-10s block=%zuB allocs=%lu (%.0f/s) frees=%lu (%.0f/s) reserved=%luB depot=%lu transfers=%lu\n",
+                kindNames[kind], blockSize, allocs, allocs / seconds, frees, frees / seconds,
+                chunks * SLAB_CHUNK * blockSize, freeCount, transfers);
+    }
+    fprintf(fp, "rss=%ldB\n", residentBytes());
+}
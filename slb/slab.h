@@ -0,0 +1,29 @@
+#ifndef SLB_H
+#define SLB_H
+#include <stdio.h>
+#include <stddef.h>
+
+/* Threads with their own caches, the others go straight to the depot */
+#define SLAB_MAX_THREADS 64
+/* Free blocks a thread keeps before giving a batch back to the depot */
+#define SLAB_MAGAZINE 32
+#define SLAB_BATCH (SLAB_MAGAZINE / 2)
+/* Blocks carved at once when the depot is empty */
+#define SLAB_CHUNK 64
+
+/*
+ * Kinds of blocks, each with its own caches and depot
+ */
+typedef enum slabKind {
+    SLAB_DIRECTORY,
+    SLAB_FILE,
+    SLAB_KINDS
+} slabKind;
+
+void slabInit(int kind, size_t blockSize);
+void *slabAlloc(int kind);
+void slabFree(int kind, void *block);
+void slabThreadFlush();
+void slabPrint(FILE *fp);
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tecnicofs-client-api.h"
+#include "../tecnicofs-api-constants.h"
+
+/*
+ * Writes files of every size that matters (empty, inline in the reply or
+ * not, in a memfd up to FILE_MAX_SIZE) and checks they are read back byte
+ * for byte, also after being copied and moved.
+ * Usage: contents-check server_socket_name
+ * Exits with EXIT_FAILURE, saying why, at the first that isn't.
+ */
+
+static char contents[FILE_MAX_SIZE], back[FILE_MAX_SIZE];
+
+static int check(char *path, int size) {
+    int res = tfsRead(path, back, sizeof(back));
+
+    if (res != size || memcmp(contents, back, size)) {
+        printf("Read: %s %d bytes, wrote %d\n", path, res, size);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int sizes[] = {0, 100, FILE_INLINE_MAX, FILE_INLINE_MAX + 1, 5000, 1 << 16, FILE_MAX_SIZE - 1};
+    int count = sizeof(sizes) / sizeof(sizes[0]);
+
+    if (argc != 2) {
+        printf("Usage: %s server_socket_name\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    sprintf(nameserver, "/tmp/%s", argv[1]);
+    sprintf(nameclient, "/tmp/clientTFS%d", getpid());
+
+    if (tfsMount(nameserver) != 0) {
+        fprintf(stderr, "Unable to mount socket: %s\n", nameserver);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < FILE_MAX_SIZE; i++)
+        contents[i] = 'a' + i % 26;
+
+    if (tfsCreate("/f", 'f') || tfsCreate("/d", 'd')) {
+        printf("Unable to create: /f /d\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (tfsWrite("/f", contents, sizes[i]) || check("/f", sizes[i]))
+            exit(EXIT_FAILURE);
+    }
+
+    /* too large */
+    if (tfsWrite("/f", contents, FILE_MAX_SIZE) == 0) {
+        printf("Wrote: /f %d bytes\n", FILE_MAX_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (tfsCopy("/f", "/g") || check("/g", sizes[count - 1]))
+        exit(EXIT_FAILURE);
+
+    if (tfsMove("/g", "/d/g") || check("/d/g", sizes[count - 1]))
+        exit(EXIT_FAILURE);
+
+    tfsUnmount();
+    exit(EXIT_SUCCESS);
+}
@@ -1,7 +1,43 @@
+#define _GNU_SOURCE
 #include "tecnicofs-client-api.h"
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 char commandSuccess[10]="SUCCESS";
 char commandFail[10]="FAIL";
 
+/* Events come to a socket of their own, so they never get in the way of
+   the replies to the other commands */
+#define WATCH_PENDING 16
+
+static int watchfd = -1;
+static char namewatch[sizeof(nameclient) + 8];
+/* events received while waiting for the reply to tfsWatch */
+static char pending[WATCH_PENDING][sizeof(int) + 1 + 2 * MAX_FILE_NAME];
+static int pendingHead = 0, pendingCount = 0;
+
+/* Lookups and stats are cached while the server lets us (a lease), the
+   server revokes the lease through the socket of the events when the
+   node changes. The least recently used entry makes room for new ones */
+#define CACHE_SIZE 64
+
+typedef struct cacheEntry {
+  int inUse;
+  char path[MAX_FILE_NAME];
+  int inumber;
+  int hasStat;
+  node_stat st;
+  long long expiry;
+  unsigned long used;
+} cacheEntry;
+
+static cacheEntry cache[CACHE_SIZE];
+static unsigned long cacheTick = 0;
+/* path being asked for, and whether its lease was revoked before the reply */
+static char *leasePath = NULL;
+static int leaseRevoked = 0;
+static unsigned long cacheHits = 0, cacheMisses = 0, cacheRevoked = 0;
+
 int setSockAddrUn(char *path, struct sockaddr_un *addr) {
 
   if (addr == NULL)
@@ -14,6 +50,176 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) {
   return SUN_LEN(addr);
 }
 
+static long long nowMs() {
+
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+
+}
+
+/* Writes a path as the server does, /a/b whatever its slashes */
+static void normalizePath(char *normalized, const char *path) {
+
+  int len = 0;
+
+  for (const char *c = path; *c && len < MAX_FILE_NAME - 2; c++) {
+    if (*c == '/' && (len == 0 || normalized[len - 1] == '/'))
+      continue;
+    if (len == 0)
+      normalized[len++] = '/';
+    normalized[len++] = *c;
+  }
+  if (len > 0 && normalized[len - 1] == '/')
+    len--;
+  normalized[len] = '\0';
+
+}
+
+/* Returns the cached entry of a path, NULL if there is none or its lease ran out */
+static cacheEntry *cacheFind(char *path) {
+
+  long long now = nowMs();
+
+  for (int i = 0; i < CACHE_SIZE; i++) {
+    if (cache[i].inUse && cache[i].expiry > now && !strcmp(cache[i].path, path)) {
+      cache[i].used = ++cacheTick;
+      return &cache[i];
+    }
+  }
+  return NULL;
+
+}
+
+/* Caches what the server said about a path, until expiry */
+static void cacheStore(char *path, int inumber, node_stat *st, long long expiry) {
+
+  cacheEntry *entry = &cache[0];
+
+  for (int i = 0; i < CACHE_SIZE; i++) {
+    if (cache[i].inUse && !strcmp(cache[i].path, path)) {
+      entry = &cache[i];
+      break;
+    }
+    /* a free entry, or else the least recently used */
+    if (entry->inUse && (!cache[i].inUse || cache[i].used < entry->used))
+      entry = &cache[i];
+  }
+
+  entry->inUse = 1;
+  strcpy(entry->path, path);
+  entry->inumber = inumber;
+  entry->hasStat = st != NULL;
+  if (st != NULL)
+    entry->st = *st;
+  entry->expiry = expiry;
+  entry->used = ++cacheTick;
+
+}
+
+/*
+ * Handles a message that came to the socket of the events: revocations
+ * are applied, the events kept for tfsNextEvent.
+ */
+static void watchMessage(char *message, int len) {
+
+  message[len] = '\0';
+
+  if (message[sizeof(int)] == 'v') {
+    char *path = message + sizeof(int) + 1;
+
+    for (int i = 0; i < CACHE_SIZE; i++) {
+      if (cache[i].inUse && !strcmp(cache[i].path, path)) {
+        cache[i].inUse = 0;
+        cacheRevoked++;
+      }
+    }
+    if (leasePath != NULL && !strcmp(leasePath, path))
+      leaseRevoked = 1;
+    return;
+  }
+
+  if (pendingCount < WATCH_PENDING) {
+    memcpy(pending[(pendingHead + pendingCount) % WATCH_PENDING], message, len + 1);
+    pendingCount++;
+  }
+
+}
+
+/* Handles every message already in the socket of the events */
+static void watchDrain() {
+
+  char message[sizeof(pending[0])];
+  int len;
+
+  if (watchfd < 0)
+    return;
+
+  while ((len = recvfrom(watchfd, message, sizeof(message) - 1, MSG_DONTWAIT, 0, 0)) > (int) sizeof(int))
+    watchMessage(message, len);
+
+}
+
+/*
+ * Sends a command from the socket of the events, and waits for its reply
+ * handling the events and revocations that come before it.
+ * Input:
+ *  - command: the command
+ *  - data: stores what comes after the result, may be NULL
+ *  - size: size of data
+ * Returns: the result
+ */
+static int watchCommand(char *command, void *data, int size) {
+
+  char reply[sizeof(pending[0])];
+  int receive, len;
+  struct sockaddr_un watch_addr;
+  socklen_t watchlen;
+
+  if (watchfd < 0) {
+    if ((watchfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+      perror("client: can't open watch socket");
+      return -1;
+    }
+
+    snprintf(namewatch, sizeof(namewatch), "%s.watch", nameclient);
+    unlink(namewatch);
+    watchlen = setSockAddrUn(namewatch, &watch_addr);
+    if (bind(watchfd, (struct sockaddr *) &watch_addr, watchlen) < 0) {
+      perror("client: watch bind error");
+      close(watchfd);
+      watchfd = -1;
+      return -1;
+    }
+  }
+
+  if (sendto(watchfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  while (1) {
+    if ((len = recvfrom(watchfd, reply, sizeof(reply) - 1, 0, 0, 0)) < (int) sizeof(int)) {
+      perror("client: recvfrom error");
+      return -1;
+    } 
+
+    memcpy(&receive, reply, sizeof(int));
+    if (receive != TECNICOFS_EVENT)
+      break;
+
+    watchMessage(reply, len);
+  }
+
+  len -= sizeof(int);
+  if (data != NULL)
+    memcpy(data, reply + sizeof(int), len < size ? len : size);
+
+  return receive;
+
+}
+
 int tfsCreate(char *path, char nodeType) {
 
   char command[MAX_INPUT_SIZE];
@@ -56,6 +262,27 @@ int tfsDelete(char *path) {
 
 }
 
+int tfsDeleteRecursive(char *path) {
+
+  char command[MAX_INPUT_SIZE];
+  int receive;
+
+  sprintf(command,"d %s r", path);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  if (recvfrom(sockfd, (void*) &receive, sizeof(&receive), 0, 0, 0) < 0) {
+    perror("client: recvfrom error");
+    return -1;
+  } 
+
+  return receive;
+
+}
+
 int tfsMove(char *from, char *to) {
 
   char command[MAX_INPUT_SIZE];
@@ -77,12 +304,12 @@ int tfsMove(char *from, char *to) {
 
 }
 
-int tfsLookup(char *path) {
+int tfsCopy(char *from, char *to) {
 
   char command[MAX_INPUT_SIZE];
   int receive;
 
-  sprintf(command,"l %s", path);
+  sprintf(command,"y %s %s", from, to);
 
   if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
     perror("client: sendto error");
@@ -98,6 +325,44 @@ int tfsLookup(char *path) {
 
 }
 
+/*
+ * Looks a path up, from the cache while the lease on it lasts.
+ * Input:
+ *  - path: path of the node
+ * Returns: the inumber of the node, or an error
+ */
+int tfsLookup(char *path) {
+
+  char command[MAX_INPUT_SIZE];
+  char normalized[MAX_FILE_NAME];
+  cacheEntry *entry;
+  int receive, lease = 0;
+  long long sent;
+
+  normalizePath(normalized, path);
+  watchDrain();
+  if ((entry = cacheFind(normalized)) != NULL) {
+    cacheHits++;
+    return entry->inumber;
+  }
+  cacheMisses++;
+
+  sprintf(command,"l %s l", path);
+
+  leasePath = normalized;
+  leaseRevoked = 0;
+  sent = nowMs();
+  receive = watchCommand(command, &lease, sizeof(lease));
+  leasePath = NULL;
+
+  /* the lease counts from when it was asked for, a bit before the server granted it */
+  if (lease > 0 && !leaseRevoked)
+    cacheStore(normalized, receive, NULL, sent + lease);
+
+  return receive;
+
+}
+
 int tfsPrint(char *path) {
 
   char command[MAX_INPUT_SIZE];
@@ -119,6 +384,425 @@ int tfsPrint(char *path) {
 
 }
 
+int tfsStats(char *path, int hottest) {
+
+  char command[MAX_INPUT_SIZE];
+  int receive;
+
+  sprintf(command,"s %s %d", path, hottest);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  if (recvfrom(sockfd, (void*) &receive, sizeof(&receive), 0, 0, 0) < 0) {
+    perror("client: recvfrom error");
+    return -1;
+  } 
+
+  return receive;
+
+}
+
+int tfsResize(int minThreads, int maxThreads) {
+
+  char command[MAX_INPUT_SIZE];
+  int receive;
+
+  sprintf(command,"n %d %d", minThreads, maxThreads);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  if (recvfrom(sockfd, (void*) &receive, sizeof(&receive), 0, 0, 0) < 0) {
+    perror("client: recvfrom error");
+    return -1;
+  } 
+
+  return receive;
+
+}
+
+int tfsSetWeight(int weight) {
+
+  char command[MAX_INPUT_SIZE];
+  int receive;
+
+  sprintf(command,"q %d", weight);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  if (recvfrom(sockfd, (void*) &receive, sizeof(&receive), 0, 0, 0) < 0) {
+    perror("client: recvfrom error");
+    return -1;
+  } 
+
+  return receive;
+
+}
+
+/*
+ * Gets the metadata of a node, from the cache while the lease on it lasts.
+ * Input:
+ *  - path: path of the node
+ *  - st: stores the metadata
+ * Returns: the inumber of the node, or an error
+ */
+int tfsStat(char *path, node_stat *st) {
+
+  char command[MAX_INPUT_SIZE];
+  char normalized[MAX_FILE_NAME];
+  struct { node_stat st; int lease; } reply = { { 0 }, 0 };
+  cacheEntry *entry;
+  int receive;
+  long long sent;
+
+  normalizePath(normalized, path);
+  watchDrain();
+  if ((entry = cacheFind(normalized)) != NULL && entry->hasStat) {
+    cacheHits++;
+    *st = entry->st;
+    return entry->inumber;
+  }
+  cacheMisses++;
+
+  sprintf(command,"i %s l", path);
+
+  leasePath = normalized;
+  leaseRevoked = 0;
+  sent = nowMs();
+  receive = watchCommand(command, &reply, sizeof(reply));
+  leasePath = NULL;
+
+  if (reply.lease > 0 && !leaseRevoked)
+    cacheStore(normalized, receive, &reply.st, sent + reply.lease);
+
+  if (receive >= 0)
+    *st = reply.st;
+
+  return receive;
+
+}
+
+/*
+ * Reads the contents of a file. Large ones come in a memfd instead of
+ * the reply, read straight from its pages.
+ * Input:
+ *  - path: path of the file
+ *  - contents: stores the contents, up to size bytes
+ *  - size: size of contents
+ * Returns: the size of the contents (more than size if they didn't fit),
+ *  or an error
+ */
+int tfsRead(char *path, char *contents, int size) {
+
+  char command[MAX_INPUT_SIZE];
+  char reply[sizeof(int) + FILE_INLINE_MAX];
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec part = { reply, sizeof(reply) };
+  struct msghdr message = { 0 };
+  struct cmsghdr *header;
+  int receive, len, fd = -1;
+
+  sprintf(command,"g %s", path);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  message.msg_iov = &part;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if ((len = recvmsg(sockfd, &message, MSG_CMSG_CLOEXEC)) < (int) sizeof(int)) {
+    perror("client: recvmsg error");
+    return -1;
+  } 
+
+  for (header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+      memcpy(&fd, CMSG_DATA(header), sizeof(int));
+  }
+
+  memcpy(&receive, reply, sizeof(int));
+  if (receive < 0) {
+    if (fd >= 0)
+      close(fd);
+    return receive;
+  }
+
+  if (fd >= 0) {
+    char *map = receive > 0 ? mmap(NULL, receive, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+
+    close(fd);
+    if (map == MAP_FAILED)
+      return TECNICOFS_ERROR_OTHER;
+    memcpy(contents, map, receive < size ? receive : size);
+    if (map != NULL)
+      munmap(map, receive);
+  } else {
+    len -= sizeof(int);
+    if (len != receive)
+      return TECNICOFS_ERROR_OTHER;
+    memcpy(contents, reply + sizeof(int), len < size ? len : size);
+  }
+
+  return receive;
+
+}
+
+/*
+ * Replaces the contents of a file. They are passed in a sealed memfd,
+ * the server copies them straight from its pages.
+ * Input:
+ *  - path: path of the file
+ *  - contents: the new contents
+ *  - size: size of contents, smaller than FILE_MAX_SIZE
+ * Returns: 0 or an error
+ */
+int tfsWrite(char *path, char *contents, int size) {
+
+  char command[MAX_INPUT_SIZE];
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec part = { command, 0 };
+  struct msghdr message = { 0 };
+  struct cmsghdr *header;
+  int receive, fd, written = 0;
+
+  if ((fd = memfd_create("tecnicofs-client", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+    perror("client: memfd error");
+    return -1;
+  }
+
+  while (written < size) {
+    int n = write(fd, contents + written, size - written);
+
+    if (n <= 0) {
+      perror("client: memfd error");
+      close(fd);
+      return -1;
+    }
+    written += n;
+  }
+
+  /* the server maps it, it must not shrink meanwhile */
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+    perror("client: memfd error");
+    close(fd);
+    return -1;
+  }
+
+  sprintf(command,"u %s", path);
+  part.iov_len = strlen(command) + 1;
+
+  message.msg_name = &serv_addr;
+  message.msg_namelen = servlen;
+  message.msg_iov = &part;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+  if (sendmsg(sockfd, &message, 0) < 0) {
+    perror("client: sendmsg error");
+    close(fd);
+    return -1;
+  } 
+  close(fd);
+
+  if (recvfrom(sockfd, (void*) &receive, sizeof(receive), 0, 0, 0) < 0) {
+    perror("client: recvfrom error");
+    return -1;
+  } 
+
+  return receive;
+
+}
+
+/*
+ * Finds the nodes under a directory matching a pattern, see the server.
+ * Input:
+ *  - path: path of the directory
+ *  - pattern: the pattern, ** for everything
+ *  - nodeType: 'f' or 'd' for only files or directories, 0 for both
+ *  - found: called with the path of each node found
+ * Returns: the number of nodes found, or an error
+ */
+int tfsFind(char *path, char *pattern, char nodeType, void (*found)(char *path)) {
+
+  char command[MAX_INPUT_SIZE];
+  char reply[MAX_REPLY_SIZE];
+  int receive, more, len, total = 0;
+
+  if (nodeType)
+    sprintf(command,"f %s %s %c", path, pattern, nodeType);
+  else
+    sprintf(command,"f %s %s", path, pattern);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  do {
+    if ((len = recvfrom(sockfd, reply, sizeof(reply), 0, 0, 0)) < (int) sizeof(int)) {
+      perror("client: recvfrom error");
+      return -1;
+    } 
+
+    memcpy(&receive, reply, sizeof(int));
+    if (receive < 0)
+      return receive;
+    if (len < 2 * (int) sizeof(int))
+      return TECNICOFS_ERROR_OTHER;
+
+    memcpy(&more, reply + sizeof(int), sizeof(int));
+    for (int i = 0, used = 2 * sizeof(int); i < receive && used < len; i++, used += strlen(reply + used) + 1)
+      found(reply + used);
+    total += receive;
+  } while (more);
+
+  return total;
+
+}
+
+/*
+ * Lists a page of the entries of a directory.
+ * Input:
+ *  - path: path of the directory
+ *  - cursor: 0 for the first page, stores the cursor of the next page
+ *    (0 after the last one)
+ *  - names: stores the names, each ending with '\0'
+ *  - size: size of names
+ * Returns: the number of names, or an error
+ */
+int tfsReadDir(char *path, int *cursor, char *names, int size) {
+
+  char command[MAX_INPUT_SIZE];
+  char reply[MAX_REPLY_SIZE];
+  int receive, len;
+
+  sprintf(command,"r %s %d", path, *cursor);
+
+  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: sendto error");
+    return -1;
+  } 
+
+  if ((len = recvfrom(sockfd, reply, sizeof(reply), 0, 0, 0)) < (int) sizeof(int)) {
+    perror("client: recvfrom error");
+    return -1;
+  } 
+
+  memcpy(&receive, reply, sizeof(int));
+  if (receive < 0)
+    return receive;
+
+  len -= 2 * sizeof(int);
+  if (len < 0 || len > size)
+    return TECNICOFS_ERROR_OTHER;
+
+  memcpy(cursor, reply + sizeof(int), sizeof(int));
+  memcpy(names, reply + 2 * sizeof(int), len);
+
+  return receive;
+
+}
+
+/*
+ * Starts getting the changes to the children of a directory, read with
+ * tfsNextEvent.
+ * Input:
+ *  - path: path of the directory
+ *  - recursive: everything under it, not only its children
+ * Returns: 0 or an error
+ */
+int tfsWatch(char *path, int recursive) {
+
+  char command[MAX_INPUT_SIZE];
+
+  sprintf(command, recursive ? "w %s r" : "w %s", path);
+
+  return watchCommand(command, NULL, 0);
+
+}
+
+int tfsUnwatch(char *path) {
+
+  char command[MAX_INPUT_SIZE];
+
+  sprintf(command,"w %s -", path);
+
+  return watchCommand(command, NULL, 0);
+
+}
+
+/*
+ * Waits for the next change to a directory being watched.
+ * Input:
+ *  - op: stores the command that made the change (c, d, m or u), or o when
+ *    events were lost and the directory in path must be read again
+ *  - path: stores the path of the node, at least MAX_FILE_NAME long
+ *  - dest: stores where it was moved to (m), at least MAX_FILE_NAME long
+ *  - timeoutMs: how long to wait, or -1 forever
+ * Returns: 0, or -1 if no event came in time
+ */
+int tfsNextEvent(char *op, char *path, char *dest, int timeoutMs) {
+
+  char event[sizeof(pending[0])];
+  struct timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 }, forever = { 0, 0 };
+  int len;
+
+  /* revocations are handled on the way, only the events are kept */
+  while (pendingCount == 0) {
+    if (watchfd < 0)
+      return -1;
+
+    setsockopt(watchfd, SOL_SOCKET, SO_RCVTIMEO, timeoutMs < 0 ? &forever : &timeout, sizeof(timeout));
+    len = recvfrom(watchfd, event, sizeof(event) - 1, 0, 0, 0);
+    setsockopt(watchfd, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
+
+    if (len < (int) sizeof(int) + 1)
+      return -1;
+    watchMessage(event, len);
+  }
+
+  memcpy(event, pending[pendingHead], sizeof(event));
+  pendingHead = (pendingHead + 1) % WATCH_PENDING;
+  pendingCount--;
+
+  *op = event[sizeof(int)];
+  strcpy(path, event + sizeof(int) + 1);
+  strcpy(dest, *op == 'm' ? event + sizeof(int) + 2 + strlen(path) : "");
+
+  return 0;
+
+}
+
+/*
+ * Gets how many lookups and stats were answered from the cache, and how
+ * many cached entries the server revoked.
+ */
+void tfsCacheStats(unsigned long *hits, unsigned long *misses, unsigned long *revoked) {
+
+  *hits = cacheHits;
+  *misses = cacheMisses;
+  *revoked = cacheRevoked;
+
+}
+
 int tfsMount(char * sockPath) {
 
   if ((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0) ) < 0) {
@@ -149,6 +833,14 @@ int tfsMount(char * sockPath) {
 }
 
 int tfsUnmount() {
+  bzero(cache, sizeof(cache));
+
+  if (watchfd >= 0) {
+    close(watchfd);
+    unlink(namewatch);
+    watchfd = -1;
+  }
+
   if(close(sockfd)){
     perror("client: unmount error");
     return -1;
@@ -24,9 +24,23 @@ char nameclient[108];
 int setSockAddrUn(char *path, struct sockaddr_un *addr);
 int tfsCreate(char *path, char nodeType);
 int tfsDelete(char *path);
+int tfsDeleteRecursive(char *path);
+int tfsCopy(char *from, char *to);
 int tfsLookup(char *path);
 int tfsPrint(char *path);
 int tfsMove(char *from, char *to);
+int tfsStats(char *path, int hottest);
+int tfsResize(int minThreads, int maxThreads);
+int tfsSetWeight(int weight);
+int tfsStat(char *path, node_stat *st);
+int tfsRead(char *path, char *contents, int size);
+int tfsWrite(char *path, char *contents, int size);
+int tfsFind(char *path, char *pattern, char nodeType, void (*found)(char *path));
+int tfsReadDir(char *path, int *cursor, char *names, int size);
+int tfsWatch(char *path, int recursive);
+int tfsUnwatch(char *path);
+int tfsNextEvent(char *op, char *path, char *dest, int timeoutMs);
+void tfsCacheStats(unsigned long *hits, unsigned long *misses, unsigned long *revoked);
 int tfsMount(char* serverName);
 int tfsUnmount();
 
@@ -32,12 +32,17 @@ void errorParse(){
     exit(EXIT_FAILURE);
 }
 
+static void printFound(char *path) {
+    printf("Found: %s\n", path);
+}
+
 void *processInput() {
     char line[MAX_INPUT_SIZE];
 
     while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
         char op;
         char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+        char nodeType;
         int res;
 
         int numTokens = sscanf(line, "%c %s %s", &op, arg1, arg2);
@@ -81,9 +86,9 @@ void *processInput() {
                     printf("Search: %s not found\n", arg1);
                 break;
             case 'd':
-                if(numTokens != 2)
+                if(numTokens != 2 && (numTokens != 3 || strcmp(arg2, "r")))
                     errorParse();
-                res = tfsDelete(arg1);
+                res = numTokens == 3 ? tfsDeleteRecursive(arg1) : tfsDelete(arg1);
                 if (!res)
                   printf("Deleted: %s\n", arg1);
                 else
@@ -98,6 +103,15 @@ void *processInput() {
                 else
                   printf("Unable to move: %s to %s\n", arg1, arg2);
                 break;
+            case 'y':
+                if(numTokens != 3)
+                    errorParse();
+                res = tfsCopy(arg1, arg2);
+                if (!res)
+                  printf("Copied: %s to %s\n", arg1, arg2);
+                else
+                  printf("Unable to copy: %s to %s\n", arg1, arg2);
+                break;
             case 'p':
                 if(numTokens != 2)
                     errorParse();
@@ -105,6 +119,116 @@ void *processInput() {
                 if (res)
                   printf("Unable to print output: %s \n", arg1);
                 break;
+            case 's':
+                if(numTokens < 2)
+                    errorParse();
+                res = tfsStats(arg1, numTokens == 3 ? atoi(arg2) : 10);
+                if (res)
+                  printf("Unable to print stats: %s \n", arg1);
+                break;
+            case 'n':
+                if(numTokens < 2)
+                    errorParse();
+                res = tfsResize(atoi(arg1), numTokens == 3 ? atoi(arg2) : atoi(arg1));
+                if (!res)
+                  printf("Resized: %s %s\n", arg1, numTokens == 3 ? arg2 : arg1);
+                else
+                  printf("Unable to resize: %s\n", arg1);
+                break;
+            case 'q':
+                if(numTokens != 2)
+                    errorParse();
+                res = tfsSetWeight(atoi(arg1));
+                if (res)
+                  printf("Unable to set weight: %s\n", arg1);
+                break;
+            case 'i': {
+                node_stat st;
+
+                if(numTokens != 2)
+                    errorParse();
+                res = tfsStat(arg1, &st);
+                if (res >= 0)
+                  printf("Stat: %s %s size=%d children=%d generation=%u mtime=%lld ctime=%lld\n", arg1,
+                         st.type == T_DIRECTORY ? "directory" : "file", st.size, st.children,
+                         st.generation, st.mtime, st.ctime);
+                else
+                  printf("Unable to stat: %s\n", arg1);
+                break;
+            }
+            case 'g': {
+                char contents[FILE_INLINE_MAX + 1];
+
+                if(numTokens != 2)
+                    errorParse();
+                res = tfsRead(arg1, contents, sizeof(contents) - 1);
+                if (res >= 0) {
+                  contents[res < sizeof(contents) - 1 ? res : sizeof(contents) - 1] = '\0';
+                  printf("Read: %s %d bytes: %s\n", arg1, res, contents);
+                } else {
+                  printf("Unable to read: %s\n", arg1);
+                }
+                break;
+            }
+            case 'u':
+                if(numTokens != 3)
+                    errorParse();
+                res = tfsWrite(arg1, arg2, strlen(arg2));
+                if (!res)
+                  printf("Wrote: %s\n", arg1);
+                else
+                  printf("Unable to write: %s\n", arg1);
+                break;
+            case 'f':
+                if(numTokens < 2)
+                    errorParse();
+                /* the type comes after the pattern */
+                nodeType = 0;
+                sscanf(line, "%*c %*s %*s %c", &nodeType);
+                res = tfsFind(arg1, numTokens == 3 ? arg2 : "**", nodeType, printFound);
+                if (res < 0)
+                  printf("Unable to find in: %s\n", arg1);
+                break;
+            case 'w':
+                if(numTokens < 2)
+                    errorParse();
+                if (numTokens == 3 && arg2[0] == '-')
+                    res = tfsUnwatch(arg1);
+                else
+                    res = tfsWatch(arg1, numTokens == 3 && arg2[0] == 'r');
+                if (res)
+                  printf("Unable to watch: %s\n", arg1);
+                break;
+            case 'e': {
+                /* e N prints the next N events, waiting up to a second for each */
+                char eventOp, path[MAX_FILE_NAME], dest[MAX_FILE_NAME];
+
+                if(numTokens != 2)
+                    errorParse();
+                for (int i = 0; i < atoi(arg1); i++) {
+                  if (tfsNextEvent(&eventOp, path, dest, 1000)) {
+                    printf("No event\n");
+                    break;
+                  }
+                  printf("Event: %c %s %s\n", eventOp, path, dest);
+                }
+                break;
+            }
+            case 'r': {
+                char names[MAX_REPLY_SIZE];
+                int cursor = 0;
+
+                if(numTokens != 2)
+                    errorParse();
+                do {
+                    res = tfsReadDir(arg1, &cursor, names, sizeof(names));
+                    for (int i = 0, used = 0; i < res; i++, used += strlen(names + used) + 1)
+                      printf("Listing: %s %s\n", arg1, names + used);
+                } while (res >= 0 && cursor != 0);
+                if (res < 0)
+                  printf("Unable to list: %s\n", arg1);
+                break;
+            }
             case '#':
                 break;
             default: { /* error */
@@ -4,11 +4,38 @@
 
 #define MAX_FILE_NAME 100
 #define MAX_INPUT_SIZE 100
+/* Largest reply, the one of readdir: the number of names (or an error),
+   the cursor of the next page (0 after the last one) and the names,
+   each ending with '\0' */
+#define MAX_REPLY_SIZE 1024
+/* Largest contents of a file. A read is answered with their size and,
+   up to FILE_INLINE_MAX bytes, the contents; larger ones, and the
+   contents of every write (too large for a request), are passed in a
+   sealed memfd (SCM_RIGHTS) */
+#define FILE_MAX_SIZE (1 << 20)
+#define FILE_INLINE_MAX (MAX_REPLY_SIZE - (int) sizeof(int))
+/* A find is answered in as many replies as needed, each with the number
+   of paths in it (or an error), 1 if more replies follow or else 0, and
+   the paths, each ending with '\0' */
 
 
 typedef enum permission { NONE, WRITE, READ, RW } permission;
 typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
 
+/*
+ * Reply to stat, after the inumber (or an error). Sizes are in bytes,
+ * times in nanoseconds since the epoch: mtime is the last change of the
+ * contents, ctime the last change of the node (created, moved or contents)
+ */
+typedef struct node_stat {
+	int type;
+	int size;
+	int children;
+	unsigned int generation;
+	long long mtime;
+	long long ctime;
+} node_stat;
+
 /* Client already has an open session with a TecnicoFS server */
 #define TECNICOFS_ERROR_OPEN_SESSION -1
 /* Doesn't exist an open session */
@@ -31,5 +58,14 @@ typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
 #define TECNICOFS_ERROR_INVALID_MODE -10
 /* Generic error */
 #define TECNICOFS_ERROR_OTHER -11
+/* Server is overloaded, try again later */
+#define TECNICOFS_ERROR_BUSY -12
+
+/* Starts the events pushed to the clients watching a directory, followed
+   by the command that made the change (c, d, m or u) and the path of the
+   node, then where it was moved to for m, each ending with '\0'. An o
+   event with the path of the directory means some events were lost. A v
+   event revokes the lease of the client on the path, see l and i */
+#define TECNICOFS_EVENT -100
 
 #endif /* TECNICOFS_API_CONSTANTS_H */
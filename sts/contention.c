@@ -0,0 +1,148 @@
+#include "contention.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stats.h"
+#include "../fs/state.h"
+
+/*
+ * Counters of one lock, either of an inode or of all the inodes at a depth.
+ * Updated with relaxed atomics by every thread that takes the lock.
+ */
+typedef struct lockCounters {
+    unsigned long long reads;
+    unsigned long long writes;
+    unsigned long long contended;
+    unsigned long long waitSum;
+    unsigned long long waitMax;
+    unsigned long long holdSum;
+} lockCounters;
+
+static int enabled = 0;
+static lockCounters perInumber[INODE_TABLE_SIZE];
+static lockCounters perDepth[STATS_MAX_DEPTH];
+/* Depth each inode was last locked at, to charge the hold time */
+static int inumberDepth[INODE_TABLE_SIZE];
+
+static void countersAcquire(lockCounters *counters, int doLockWrite, long long wait){
+    unsigned long long max = __atomic_load_n(&counters->waitMax, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(doLockWrite ? &counters->writes : &counters->reads, 1, __ATOMIC_RELAXED);
+    if (wait <= 0)
+        return;
+
+    __atomic_fetch_add(&counters->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->waitSum, wait, __ATOMIC_RELAXED);
+    while (wait > max && !__atomic_compare_exchange_n(&counters->waitMax, &max, wait,
+            0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void countersPrint(FILE *fp, const char *label, int id, lockCounters *counters){
+    unsigned long long reads = __atomic_load_n(&counters->reads, __ATOMIC_RELAXED);
+    unsigned long long writes = __atomic_load_n(&counters->writes, __ATOMIC_RELAXED);
+
+    if (reads + writes == 0)
+        return;
+
+    fprintf(fp, "%s %d reads=%llu writes=%llu contended=%llu wait=%lluns maxwait=%lluns hold=%lluns\n",
+            label, id, reads, writes,
+            __atomic_load_n(&counters->contended, __ATOMIC_RELAXED),
+            __atomic_load_n(&counters->waitSum, __ATOMIC_RELAXED),
+            __atomic_load_n(&counters->waitMax, __ATOMIC_RELAXED),
+            __atomic_load_n(&counters->holdSum, __ATOMIC_RELAXED));
+}
+
+/* Threads waited longer for a, or as long but took it more often */
+static int hotter(int a, int b){
+    unsigned long long waitA = __atomic_load_n(&perInumber[a].waitSum, __ATOMIC_RELAXED);
+    unsigned long long waitB = __atomic_load_n(&perInumber[b].waitSum, __ATOMIC_RELAXED);
+
+    if (waitA != waitB)
+        return waitA > waitB;
+
+    return __atomic_load_n(&perInumber[a].reads, __ATOMIC_RELAXED) + __atomic_load_n(&perInumber[a].writes, __ATOMIC_RELAXED) >
+           __atomic_load_n(&perInumber[b].reads, __ATOMIC_RELAXED) + __atomic_load_n(&perInumber[b].writes, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Turns contention tracking on. Must be called before the threads start.
+ */
+void contentionEnable(){
+    enabled = 1;
+}
+
+/*
+ * Returns: 1 if contention is being tracked, 0 otherwise
+ */
+int contentionEnabled(){
+    return enabled;
+}
+
+/*
+ * Records that an inode lock was taken.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - depth: level of the i-node in the tree, the root is 0
+ *  - doLockWrite: if the lock was taken for writing
+ *  - wait: time waited for the lock in nanoseconds, 0 if it was free
+ */
+void contentionRecordAcquire(int inumber, int depth, int doLockWrite, long long wait){
+    if (depth >= STATS_MAX_DEPTH)
+        depth = STATS_MAX_DEPTH - 1;
+
+    __atomic_store_n(&inumberDepth[inumber], depth, __ATOMIC_RELAXED);
+    countersAcquire(&perInumber[inumber], doLockWrite, wait);
+    countersAcquire(&perDepth[depth], doLockWrite, wait);
+}
+
+/*
+ * Records that an inode lock was released.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - hold: time the lock was held in nanoseconds
+ */
+void contentionRecordRelease(int inumber, long long hold){
+    int depth = __atomic_load_n(&inumberDepth[inumber], __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&perInumber[inumber].holdSum, hold, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&perDepth[depth].holdSum, hold, __ATOMIC_RELAXED);
+}
+
+/*
+ * Prints the counters per depth and of the inodes threads waited the most for.
+ * Input:
+ *  - fp: pointer to output file
+ *  - top: number of inodes to print
+ */
+void contentionPrint(FILE *fp, int top){
+    int order[INODE_TABLE_SIZE];
+
+    if (!enabled) {
+        fprintf(fp, "# contention tracking disabled (start the server with -c)\n");
+        return;
+    }
+
+    fprintf(fp, "# contention per depth\n");
+    for (int depth = 0; depth < STATS_MAX_DEPTH; depth++)
+        countersPrint(fp, "depth", depth, &perDepth[depth]);
+
+    /* insertion sort, the table is small */
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        int j = i;
+
+        while (j > 0 && hotter(i, order[j - 1])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    if (top > INODE_TABLE_SIZE)
+        top = INODE_TABLE_SIZE;
+
+    fprintf(fp, "# %d hottest inodes\n", top);
+    for (int i = 0; i < top; i++)
+        countersPrint(fp, "inumber", order[i], &perInumber[order[i]]);
+}
@@ -0,0 +1,14 @@
+#ifndef CONTENTION_H
+#define CONTENTION_H
+#include <stdio.h>
+
+/* Hottest inodes printed when the client doesn't ask for a number */
+#define CONTENTION_DEFAULT_TOP 10
+
+void contentionEnable();
+int contentionEnabled();
+void contentionRecordAcquire(int inumber, int depth, int doLockWrite, long long wait);
+void contentionRecordRelease(int inumber, long long hold);
+void contentionPrint(FILE *fp, int top);
+
+#endif
@@ -0,0 +1,292 @@
+#include "stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../fs/state.h"
+
+/*
+ * Counters of one thread. Only the owner thread writes to its slot (except
+ * for the last slot, shared by the threads beyond STATS_MAX_THREADS while
+ * no other is free), so the updates are relaxed atomics and never take a
+ * lock. A slot is given back when its thread finishes, keeping its
+ * counters, and the next thread adds to them.
+ */
+typedef struct threadStats {
+    statsHistogram ops[OP_COUNT];
+    unsigned long long failures[OP_COUNT];
+    statsHistogram queue;
+    statsHistogram lockWait[STATS_MAX_DEPTH];
+    unsigned long long filter[FILTER_COUNT];
+    int inUse;
+} threadStats;
+
+static threadStats statsTable[STATS_MAX_THREADS];
+static int usedSlots = 0;
+static __thread threadStats *myStats = NULL;
+static pthread_key_t slotKey;
+static int slotKeyMade = 0;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+static const char *opNames[OP_COUNT] = {
+    "create", "lookup", "delete", "move", "print", "stats", "readdir", "stat", "copy", "find", "read", "write"
+};
+
+/* Gives the slot of a finishing thread to the next thread that claims one */
+static void releaseSlot(void *slot){
+    __atomic_store_n(&((threadStats *) slot)->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static void createSlotKey(){
+    slotKeyMade = pthread_key_create(&slotKey, releaseSlot) == 0;
+}
+
+/*
+ * Returns the slot of the calling thread, claiming a free one on first use
+ * (released by the destructor of slotKey when the thread finishes), or the
+ * shared last slot when none is free.
+ */
+static threadStats *getMyStats(){
+    if (myStats != NULL)
+        return myStats;
+
+    pthread_once(&slotKeyOnce, createSlotKey);
+
+    for (int slot = 0; slot < STATS_MAX_THREADS; slot++) {
+        int expected = 0, used = __atomic_load_n(&usedSlots, __ATOMIC_RELAXED);
+
+        if (!__atomic_compare_exchange_n(&statsTable[slot].inUse, &expected, 1,
+                0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        /* statsPrint adds up the slots up to the last one ever used */
+        while (used < slot + 1 && !__atomic_compare_exchange_n(&usedSlots, &used, slot + 1,
+                0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        myStats = &statsTable[slot];
+        /* without the key nothing gives it back, kept as if shared */
+        if (slotKeyMade)
+            pthread_setspecific(slotKey, myStats);
+        return myStats;
+    }
+
+    __atomic_store_n(&usedSlots, STATS_MAX_THREADS, __ATOMIC_RELEASE);
+    myStats = &statsTable[STATS_MAX_THREADS - 1];
+    return myStats;
+}
+
+/* Maps a value to its histogram bucket */
+static int bucketIndex(unsigned long long value){
+    if (value < STATS_SUB_BUCKETS)
+        return (int) value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int sub = (value >> (msb - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+
+    return (msb - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + sub;
+}
+
+/* Smallest value that falls in the given bucket */
+static unsigned long long bucketLowest(int index){
+    if (index < STATS_SUB_BUCKETS)
+        return index;
+
+    int msb = index / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+    unsigned long long sub = index % STATS_SUB_BUCKETS;
+
+    return (1ULL << msb) | (sub << (msb - STATS_SUB_BITS));
+}
+
+static void histogramRecord(statsHistogram *histogram, long long elapsed){
+    unsigned long long value = elapsed < 0 ? 0 : elapsed;
+    unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucketIndex(value)], 1, __ATOMIC_RELAXED);
+
+    while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value,
+            0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void histogramAdd(statsHistogram *total, statsHistogram *histogram){
+    unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+    total->count += __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    total->sum += __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+    if (max > total->max)
+        total->max = max;
+
+    for (int i = 0; i < STATS_BUCKETS; i++)
+        total->buckets[i] += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+}
+
+/* Value below which the given fraction of the samples falls */
+static unsigned long long histogramPercentile(statsHistogram *histogram, double fraction){
+    unsigned long long wanted = histogram->count * fraction;
+    unsigned long long seen = 0;
+
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > wanted && i + 1 < STATS_BUCKETS && bucketLowest(i + 1) - 1 < histogram->max)
+            return bucketLowest(i + 1) - 1;
+        if (seen > wanted)
+            return histogram->max;
+    }
+    return histogram->max;
+}
+
+static void histogramPrint(FILE *fp, const char *name, statsHistogram *histogram){
+    if (histogram->count == 0)
+        return;
+
+    fprintf(fp, "%-10s count=%llu mean=%lluns p50=%lluns p90=%lluns p99=%lluns max=%lluns\n",
+            name, histogram->count, histogram->sum / histogram->count,
+            histogramPercentile(histogram, 0.50), histogramPercentile(histogram, 0.90),
+            histogramPercentile(histogram, 0.99), histogram->max);
+}
+
+
+/*
+ * Current time of a monotonic clock, in nanoseconds.
+ */
+long long statsNow(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * Maps a command token to its operation.
+ * Returns: the operation or FAIL if the token has no counters
+ */
+int statsOpFromToken(char token){
+    switch (token) {
+        case 'c': return OP_CREATE;
+        case 'l': return OP_LOOKUP;
+        case 'd': return OP_DELETE;
+        case 'm': return OP_MOVE;
+        case 'p': return OP_PRINT;
+        case 's': return OP_STATS;
+        case 'r': return OP_READDIR;
+        case 'i': return OP_STAT;
+        case 'y': return OP_COPY;
+        case 'f': return OP_FIND;
+        case 'g': return OP_READ;
+        case 'u': return OP_WRITE;
+        default: return FAIL;
+    }
+}
+
+/*
+ * Records an operation served by the calling thread.
+ * Input:
+ *  - op: the operation
+ *  - result: what the operation returned to the client
+ *  - elapsed: service time in nanoseconds
+ */
+void statsRecordOp(int op, int result, long long elapsed){
+    threadStats *stats;
+
+    if (op < 0 || op >= OP_COUNT)
+        return;
+
+    stats = getMyStats();
+    histogramRecord(&stats->ops[op], elapsed);
+    if (result == FAIL)
+        __atomic_fetch_add(&stats->failures[op], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Records the time spent waiting for an i-node lock.
+ * Input:
+ *  - depth: level of the i-node in the tree, the root is 0
+ *  - elapsed: wait time in nanoseconds
+ */
+void statsRecordLockWait(int depth, long long elapsed){
+    if (depth >= STATS_MAX_DEPTH)
+        depth = STATS_MAX_DEPTH - 1;
+
+    histogramRecord(&getMyStats()->lockWait[depth], elapsed);
+}
+
+/*
+ * Records the time a request waited before being served.
+ */
+void statsRecordQueue(long long elapsed){
+    histogramRecord(&getMyStats()->queue, elapsed);
+}
+
+/*
+ * Records what the name filter of a directory told a lookup.
+ * Input:
+ *  - outcome: FILTER_NEGATIVE, FILTER_FOUND or FILTER_FALSE_POSITIVE
+ */
+void statsRecordFilter(int outcome){
+    __atomic_fetch_add(&getMyStats()->filter[outcome], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Prints the counters of all threads added together.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void statsPrint(FILE *fp){
+    statsHistogram *total = calloc(1, sizeof(statsHistogram));
+    int slots = __atomic_load_n(&usedSlots, __ATOMIC_RELAXED);
+    unsigned long long filter[FILTER_COUNT], missing;
+    char name[32];
+
+    if (total == NULL)
+        return;
+    if (slots > STATS_MAX_THREADS)
+        slots = STATS_MAX_THREADS;
+
+    fprintf(fp, "threads=%d\n", slots);
+
+    fprintf(fp, "# operations\n");
+    for (int op = 0; op < OP_COUNT; op++) {
+        unsigned long long failures = 0;
+
+        memset(total, 0, sizeof(statsHistogram));
+        for (int i = 0; i < slots; i++) {
+            histogramAdd(total, &statsTable[i].ops[op]);
+            failures += __atomic_load_n(&statsTable[i].failures[op], __ATOMIC_RELAXED);
+        }
+        histogramPrint(fp, opNames[op], total);
+        if (total->count)
+            fprintf(fp, "%-10s fail=%llu\n", "", failures);
+    }
+
+    fprintf(fp, "# queue\n");
+    memset(total, 0, sizeof(statsHistogram));
+    for (int i = 0; i < slots; i++)
+        histogramAdd(total, &statsTable[i].queue);
+    histogramPrint(fp, "queue", total);
+
+    fprintf(fp, "# lock wait per depth\n");
+    for (int depth = 0; depth < STATS_MAX_DEPTH; depth++) {
+        memset(total, 0, sizeof(statsHistogram));
+        for (int i = 0; i < slots; i++)
+            histogramAdd(total, &statsTable[i].lockWait[depth]);
+        snprintf(name, sizeof(name), "depth%d", depth);
+        histogramPrint(fp, name, total);
+    }
+
+    fprintf(fp, "# directory filters\n");
+    for (int outcome = 0; outcome < FILTER_COUNT; outcome++) {
+        filter[outcome] = 0;
+        for (int i = 0; i < slots; i++)
+            filter[outcome] += __atomic_load_n(&statsTable[i].filter[outcome], __ATOMIC_RELAXED);
+    }
+    missing = filter[FILTER_NEGATIVE] + filter[FILTER_FALSE_POSITIVE];
+    fprintf(fp, "negative=%llu (not read) found=%llu false positive=%llu (read, not there) false positive rate=%.3f\n",
+            filter[FILTER_NEGATIVE], filter[FILTER_FOUND], filter[FILTER_FALSE_POSITIVE],
+            missing ? (double) filter[FILTER_FALSE_POSITIVE] / missing : 0.0);
+
+    free(total);
+}
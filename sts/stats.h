@@ -0,0 +1,65 @@
+#ifndef STS_H
+#define STS_H
+#include <stdio.h>
+
+/* Max number of threads with their own counters, the rest share the last slot */
+#define STATS_MAX_THREADS 64
+
+/* Histogram buckets: each power of two is split in STATS_SUB_BUCKETS */
+#define STATS_SUB_BITS 2
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS (64 * STATS_SUB_BUCKETS)
+
+/* Deepest inode level with its own lock wait counters */
+#define STATS_MAX_DEPTH 16
+
+/*
+ * Operations with their own counters and latency histogram
+ */
+typedef enum statsOp {
+    OP_CREATE,
+    OP_LOOKUP,
+    OP_DELETE,
+    OP_MOVE,
+    OP_PRINT,
+    OP_STATS,
+    OP_READDIR,
+    OP_STAT,
+    OP_COPY,
+    OP_FIND,
+    OP_READ,
+    OP_WRITE,
+    OP_COUNT
+} statsOp;
+
+/*
+ * What the name filter of a directory told a lookup: the name surely
+ * isn't there (no entry read), or it may be and was found or not (a
+ * false positive)
+ */
+typedef enum statsFilter {
+    FILTER_NEGATIVE,
+    FILTER_FOUND,
+    FILTER_FALSE_POSITIVE,
+    FILTER_COUNT
+} statsFilter;
+
+/*
+ * Latency histogram, values in nanoseconds
+ */
+typedef struct statsHistogram {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long long buckets[STATS_BUCKETS];
+} statsHistogram;
+
+long long statsNow();
+int statsOpFromToken(char token);
+void statsRecordOp(int op, int result, long long elapsed);
+void statsRecordLockWait(int depth, long long elapsed);
+void statsRecordQueue(long long elapsed);
+void statsRecordFilter(int outcome);
+void statsPrint(FILE *fp);
+
+#endif
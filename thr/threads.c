@@ -1,5 +1,7 @@
+#define _GNU_SOURCE
 #include "threads.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,28 +9,275 @@
 
 pthread_mutex_t lockM = PTHREAD_MUTEX_INITIALIZER;
 
-/*  Creates threads and associates tasks
-    Input
-        char* numThreads -> Number of threads to be created
-        void *(*fnThread)() -> Pointer to the functions to be executed */
-void poolThreads(int numberThreads, void *(*fnThread)()){
-    
-    pthread_t tid[numberThreads];
-    int i;
-
-    for (i=0; i<numberThreads; i++){
-    
-        if (pthread_create(&tid[i], NULL, fnThread, NULL)!=0){
-            /* Error Handling */
-            errorParse("Error while creating task.\n");
+/* Kind of the rwlocks made by initLockRW */
+static int rwlockKind = PTHREAD_RWLOCK_PREFER_READER_NP;
+
+/* Pin each thread of the pool to its own CPU */
+static int pinning = 0;
+static int numberNodes = 1;
+/* CPUs the process may use, grouped by NUMA node, and the node of each */
+static int cpuOrder[CPU_SETSIZE];
+static int cpuNodes[CPU_SETSIZE];
+static int numberCpus = 0;
+/* Node the calling thread was pinned to */
+static __thread int myNode = 0;
+
+/*
+ * A thread of the pool, its slot is kept while it runs
+ */
+typedef struct poolTask {
+    int inUse;
+    int node;
+} poolTask;
+
+/* The pool, see poolStart. Changed with poolLock held, except for the
+ * idle count, and the size and bounds are read without it */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+static poolTask poolTasks[POOL_MAX_THREADS];
+static void *(*poolFn)();
+static int poolMin = 0;
+static int poolMax = 0;
+/* threads not leaving, threads still running, and threads waiting for work */
+static int poolSize = 0;
+static int poolRunning = 0;
+static int poolIdle = 0;
+static int poolStopped = 0;
+
+/*  Reads the CPUs of a NUMA node, listed by sysfs as ranges ("0-3,8-11")
+    Returns: 0 or -1 if there is no such node */
+static int readNodeCpus(int node, cpu_set_t *cpus){
+    char path[64], cpuList[1024];
+    char *range, *saveptr;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    if (fgets(cpuList, sizeof(cpuList), fp) == NULL)
+        cpuList[0] = '\0';
+    fclose(fp);
+
+    CPU_ZERO(cpus);
+    for (range = strtok_r(cpuList, ",\n", &saveptr); range != NULL; range = strtok_r(NULL, ",\n", &saveptr)) {
+        int first, last;
+        int n = sscanf(range, "%d-%d", &first, &last);
+
+        if (n < 1)
+            continue;
+        if (n == 1)
+            last = first;
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, cpus);
+    }
+    return 0;
+}
+
+/*  Lists the CPUs the process may run on, the ones of node 0 first,
+    so consecutive threads share a node before spilling to the next */
+static void findCpus(){
+    cpu_set_t allowed, nodeCpus;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        errorParse("Error while reading the CPU affinity\n");
+
+    numberCpus = 0;
+    numberNodes = 0;
+    for (int node = 0; node < THREAD_MAX_NODES && readNodeCpus(node, &nodeCpus) == 0; node++) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && CPU_ISSET(cpu, &nodeCpus)) {
+                cpuOrder[numberCpus] = cpu;
+                cpuNodes[numberCpus++] = node;
+            }
         }
+        numberNodes = node + 1;
     }
 
-    for (i=0; i<numberThreads; i++){
-        if(pthread_join(tid[i], NULL))
-            /* Error Handling */
-            errorParse("Error while joining the threads\n");
+    /* no NUMA information, take every CPU as node 0 */
+    if (numberCpus == 0) {
+        numberNodes = 1;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpuOrder[numberCpus] = cpu;
+                cpuNodes[numberCpus++] = 0;
+            }
+        }
+    }
+}
+
+static void poolLockMutex(){
+    if(pthread_mutex_lock(&poolLock))
+        errorParse("Error while locking the pool\n");
+}
+
+static void poolUnlockMutex(){
+    if(pthread_mutex_unlock(&poolLock))
+        errorParse("Error while unlocking the pool\n");
+}
+
+static void *poolWorker(void *arg){
+    poolTask *task = arg;
+
+    myNode = task->node;
+    poolFn(NULL);
+
+    poolLockMutex();
+    task->inUse = 0;
+    if (--poolRunning == 0)
+        pthread_cond_broadcast(&poolDone);
+    poolUnlockMutex();
+
+    return NULL;
+}
+
+/*  Starts one more thread, with poolLock held. With pinning, the thread in
+    slot i gets the i-th CPU, so threads that come and go reuse the same CPUs */
+static void poolSpawn(){
+    pthread_t tid;
+    pthread_attr_t attr;
+    int slot = 0;
+
+    while (slot < POOL_MAX_THREADS && poolTasks[slot].inUse)
+        slot++;
+    if (slot == POOL_MAX_THREADS)
+        return;
+
+    if (pthread_attr_init(&attr) || pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED))
+        errorParse("Error while initing thread attributes\n");
+
+    poolTasks[slot].node = 0;
+    if (pinning && numberCpus > 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpuOrder[slot % numberCpus], &cpus);
+        if (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus))
+            errorParse("Error while pinning a thread\n");
+        poolTasks[slot].node = cpuNodes[slot % numberCpus];
+    }
+
+    poolTasks[slot].inUse = 1;
+    if (pthread_create(&tid, &attr, poolWorker, &poolTasks[slot])!=0){
+        /* Error Handling */
+        errorParse("Error while creating task.\n");
+    }
+    pthread_attr_destroy(&attr);
+
+    poolSize++;
+    poolRunning++;
+    __atomic_fetch_add(&poolIdle, 1, __ATOMIC_RELAXED);
+}
+
+/*  Starts the pool of threads, each running fnThread until it returns.
+    The pool grows while every thread is busy and shrinks when threads
+    stay idle, between the bounds of poolSetBounds (by default exactly
+    numberThreads).
+    Input
+        int numberThreads -> Number of threads to start with
+        void *(*fnThread)() -> Pointer to the functions to be executed */
+void poolStart(int numberThreads, void *(*fnThread)()){
+    if (pinning)
+        findCpus();
+
+    poolLockMutex();
+    poolFn = fnThread;
+    if (poolMin == 0)
+        poolMin = poolMax = numberThreads;
+    if (numberThreads < poolMin)
+        numberThreads = poolMin;
+    if (numberThreads > poolMax)
+        numberThreads = poolMax;
+
+    while (poolSize < numberThreads)
+        poolSpawn();
+    poolUnlockMutex();
+}
+
+/*  Sets how many threads the pool may have. It grows to the minimum right
+    away, threads over the maximum leave after their current command.
+    Returns: 0 or -1 if the bounds are not valid */
+int poolSetBounds(int minThreads, int maxThreads){
+    if (minThreads < 1 || minThreads > maxThreads || maxThreads > POOL_MAX_THREADS)
+        return -1;
+
+    poolLockMutex();
+    __atomic_store_n(&poolMin, minThreads, __ATOMIC_RELAXED);
+    __atomic_store_n(&poolMax, maxThreads, __ATOMIC_RELAXED);
+    while (poolFn != NULL && !poolStopped && poolSize < poolMin)
+        poolSpawn();
+    poolUnlockMutex();
+
+    return 0;
+}
+
+/*  Returns: the number of threads in the pool */
+int poolGetSize(){
+    return __atomic_load_n(&poolSize, __ATOMIC_RELAXED);
+}
+
+/*  Called by a thread when it gets work. If no other thread is left
+    waiting for work, requests are piling up and the pool grows by one. */
+void poolWorkerBusy(){
+    if (__atomic_sub_fetch(&poolIdle, 1, __ATOMIC_RELAXED) > 0)
+        return;
+
+    poolLockMutex();
+    if (!poolStopped && poolSize < poolMax)
+        poolSpawn();
+    poolUnlockMutex();
+}
+
+/*  Called by a thread when it is done with its work */
+void poolWorkerIdle(){
+    __atomic_fetch_add(&poolIdle, 1, __ATOMIC_RELAXED);
+}
+
+/*  Called by an idle thread before and after waiting for work. Once the
+    pool is stopped a thread only leaves when there is nothing left to
+    drain, a wait that timed out may be followed by more requests.
+    Input
+        int reason -> POOL_WORKER_WAITING, POOL_WORKER_TIMED_OUT or
+                      POOL_WORKER_DRAINED
+    Returns: 1 if the thread must return, leaving the pool */
+int poolWorkerShouldExit(int reason){
+    int leave;
+
+    /* nearly always, no need to lock */
+    if (reason == POOL_WORKER_WAITING && __atomic_load_n(&poolSize, __ATOMIC_RELAXED) <= __atomic_load_n(&poolMax, __ATOMIC_RELAXED))
+        return 0;
+
+    poolLockMutex();
+    leave = poolSize > poolMax || (reason == POOL_WORKER_TIMED_OUT && poolSize > poolMin) ||
+            (reason == POOL_WORKER_DRAINED && poolStopped);
+    if (leave) {
+        poolSize--;
+        __atomic_fetch_sub(&poolIdle, 1, __ATOMIC_RELAXED);
     }
+    poolUnlockMutex();
+
+    return leave;
+}
+
+/*  Stops the pool: threads finish the work they have and what is still
+    waiting (see poolStopping), then leave */
+void poolStop(){
+    poolLockMutex();
+    __atomic_store_n(&poolStopped, 1, __ATOMIC_RELEASE);
+    poolUnlockMutex();
+}
+
+/*  Returns: 1 once poolStop was called */
+int poolStopping(){
+    return __atomic_load_n(&poolStopped, __ATOMIC_ACQUIRE);
+}
+
+/*  Waits for every thread of the pool to return */
+void poolJoin(){
+    poolLockMutex();
+    while (poolRunning > 0)
+        if (pthread_cond_wait(&poolDone, &poolLock))
+            errorParse("Error while waiting for the pool\n");
+    poolUnlockMutex();
 }
 
 int getNumberThreads(char *numThreads){
@@ -42,6 +291,23 @@ int getNumberThreads(char *numThreads){
 }
 
 
+/*  Chooses if the pool pins each thread to a CPU, filling the CPUs of
+    one NUMA node before the next. Must be called before poolStart. */
+void setThreadPinning(int enabled){
+    pinning = enabled;
+}
+
+/*  Returns: the NUMA node the calling thread was pinned to, 0 if it was not */
+int getThreadNode(){
+    return myNode;
+}
+
+/*  Returns: the number of NUMA nodes threads are pinned to, 1 if not pinning */
+int getNumberNodes(){
+    return numberNodes;
+}
+
+
 /* ************************
 ******  MUTEX FUNCTIONS  **
 ************************  */
@@ -78,7 +344,7 @@ void wait(pthread_cond_t *varCond){
         errorParse("Error while waiting");
 }
 
-void signal(pthread_cond_t *varCond){
+void signalCond(pthread_cond_t *varCond){
     if(pthread_cond_signal(varCond))
         /* Error handling */
         errorParse("Error while signaling");
@@ -98,9 +364,23 @@ void broadcast(pthread_cond_t *varCond){
 
 
 void initLockRW(pthread_rwlock_t *lockRW){
-    if(pthread_rwlock_init(lockRW, NULL))
+    pthread_rwlockattr_t attr;
+
+    if(pthread_rwlockattr_init(&attr) || pthread_rwlockattr_setkind_np(&attr, rwlockKind))
+        errorParse("Error while Initing RWlock attributes\n");
+
+    if(pthread_rwlock_init(lockRW, &attr))
         /* Error Handling */
         errorParse("Error while Initing RWlock\n");
+
+    pthread_rwlockattr_destroy(&attr);
+}
+
+/*  Chooses if the rwlocks made from now on let a waiting writer in before
+    new readers (glibc prefers readers by default). Those locks can't be
+    read locked twice by the same thread. */
+void setLockPreferWriters(int enabled){
+    rwlockKind = enabled ? PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP : PTHREAD_RWLOCK_PREFER_READER_NP;
 }
 
 void lockReadRW(pthread_rwlock_t *lockRW){
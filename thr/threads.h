@@ -5,8 +5,31 @@
 #include "../lst/list.h"
 
 
-void poolThreads(int numberThreads, void *(*fnThread)());
+/* NUMA nodes looked at when pinning threads */
+#define THREAD_MAX_NODES 8
+/* Most threads the pool can have */
+#define POOL_MAX_THREADS 64
+/* How long a thread waits for work before the pool may shrink */
+#define POOL_IDLE_TIMEOUT_MS 1000
+/* Why a thread asks poolWorkerShouldExit: about to wait for work, the
+   wait timed out, or there is no work left to drain */
+#define POOL_WORKER_WAITING 0
+#define POOL_WORKER_TIMED_OUT 1
+#define POOL_WORKER_DRAINED 2
+
+void poolStart(int numberThreads, void *(*fnThread)());
+int poolSetBounds(int minThreads, int maxThreads);
+int poolGetSize();
+void poolWorkerBusy();
+void poolWorkerIdle();
+int poolWorkerShouldExit(int reason);
+void poolStop();
+int poolStopping();
+void poolJoin();
 int getNumberThreads(char *numThreads);
+void setThreadPinning(int enabled);
+int getThreadNode();
+int getNumberNodes();
 
 /* Mutex */
 void initLockMutex();
@@ -14,11 +37,12 @@ void lockMutex();
 void unlockMutex();
 void destroyMutex();
 void wait(pthread_cond_t *varCond);
-void signal(pthread_cond_t *varCond);
+void signalCond(pthread_cond_t *varCond);
 void broadcast(pthread_cond_t *varCond);
 
 /* RW */
 void initLockRW(pthread_rwlock_t* lockRW);
+void setLockPreferWriters(int enabled);
 void lockReadRW(pthread_rwlock_t *lockRW);
 void lockWriteRW(pthread_rwlock_t *lockRW);
 int tryLockRead(pthread_rwlock_t *lockRW);
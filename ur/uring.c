@@ -0,0 +1,163 @@
+#include "uring.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "../fs/state.h"
+
+static int uringSetup(unsigned entries, struct io_uring_params *params){
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned waitFor, unsigned flags){
+    return syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, flags, NULL, 0);
+}
+
+
+/*
+ * Sets up an io_uring.
+ * Input:
+ *  - ring: the ring
+ *  - entries: submission entries, a power of two
+ * Returns: SUCCESS, or FAIL if the kernel doesn't have io_uring (or it is
+ *  disabled), errno tells why
+ */
+int uringInit(uring *ring, unsigned entries){
+    struct io_uring_params params;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    if ((ring->fd = uringSetup(entries, &params)) < 0)
+        return FAIL;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    /* both rings in a single mapping on newer kernels */
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED)
+        goto failed;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            munmap(ring->sqRing, ring->sqRingSize);
+            goto failed;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cqRing != ring->sqRing)
+            munmap(ring->cqRing, ring->cqRingSize);
+        munmap(ring->sqRing, ring->sqRingSize);
+        goto failed;
+    }
+
+    sq = ring->sqRing;
+    ring->sqHead = (unsigned*) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sq + params.sq_off.array);
+
+    cq = ring->cqRing;
+    ring->cqHead = (unsigned*) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    return SUCCESS;
+
+failed:
+    close(ring->fd);
+    ring->fd = -1;
+    return FAIL;
+}
+
+/*
+ * Releases an io_uring, the kernel cancelling whatever is still in flight.
+ */
+void uringDestroy(uring *ring){
+    if (ring->fd < 0)
+        return;
+
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/*
+ * Takes the next submission entry, cleared, to be filled and then
+ * submitted with uringSubmit.
+ * Returns: the entry, or NULL if the submission ring is full
+ */
+struct io_uring_sqe *uringGetSqe(uring *ring){
+    unsigned tail = *ring->sqTail + ring->toSubmit;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) > ring->sqMask)
+        return NULL;
+
+    sqe = &ring->sqes[tail & ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[tail & ring->sqMask] = tail & ring->sqMask;
+    ring->toSubmit++;
+
+    return sqe;
+}
+
+/*
+ * Submits the entries filled and waits for completions, in a single
+ * system call.
+ * Input:
+ *  - ring: the ring
+ *  - waitFor: completions to wait for, 0 to only submit
+ * Returns: the number of entries submitted, or -1 (errno set)
+ */
+int uringSubmit(uring *ring, unsigned waitFor){
+    unsigned tail = *ring->sqTail + ring->toSubmit;
+    /* with the ones a failed call left in the ring */
+    unsigned toSubmit = tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+    ring->toSubmit = 0;
+
+    return uringEnter(ring->fd, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+}
+
+/*
+ * Returns: the oldest completion not seen yet, or NULL if there are none
+ */
+struct io_uring_cqe *uringPeekCqe(uring *ring){
+    unsigned head = *ring->cqHead;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & ring->cqMask];
+}
+
+/*
+ * Gives the completion returned by uringPeekCqe back to the kernel.
+ */
+void uringSeenCqe(uring *ring){
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
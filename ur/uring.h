@@ -0,0 +1,38 @@
+#ifndef UR_H
+#define UR_H
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * An io_uring set up with the raw system calls: the submission and
+ * completion rings shared with the kernel, and the submission entries.
+ * Only one thread may use it.
+ */
+typedef struct uring {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    /* entries filled and not submitted yet */
+    unsigned toSubmit;
+} uring;
+
+int uringInit(uring *ring, unsigned entries);
+void uringDestroy(uring *ring);
+struct io_uring_sqe *uringGetSqe(uring *ring);
+int uringSubmit(uring *ring, unsigned waitFor);
+struct io_uring_cqe *uringPeekCqe(uring *ring);
+void uringSeenCqe(uring *ring);
+
+#endif
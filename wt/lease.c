@@ -0,0 +1,222 @@
+#include "lease.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "watch.h"
+#include "../er/error.h"
+#include "../sts/stats.h"
+#include "../fs/state.h"
+
+/*
+ * A client allowed to cache what it was told about a path until expiry,
+ * unless the lease is revoked first
+ */
+typedef struct leaseEntry {
+    int inUse;
+    char path[MAX_FILE_NAME];
+    int kinds;
+    struct sockaddr_un client;
+    socklen_t clientLen;
+    long long expiry;
+} leaseEntry;
+
+/* leases and the counters are changed with leaseLock held, except where atomic */
+static pthread_mutex_t leaseLock = PTHREAD_MUTEX_INITIALIZER;
+static leaseEntry leases[LEASE_MAX];
+static int held = 0;
+
+static int sock = -1;
+
+static unsigned long granted = 0;
+static unsigned long renewed = 0;
+static unsigned long refused = 0;
+static unsigned long revoked = 0;
+static unsigned long expired = 0;
+static unsigned long late = 0;
+
+static void leaseLockMutex(){
+    if (pthread_mutex_lock(&leaseLock))
+        errorParse("Error while locking the leases\n");
+}
+
+static void leaseUnlockMutex(){
+    if (pthread_mutex_unlock(&leaseLock))
+        errorParse("Error while unlocking the leases\n");
+}
+
+/* Frees a lease, with leaseLock held */
+static void leaseFree(leaseEntry *lease){
+    lease->inUse = 0;
+    __atomic_fetch_sub(&held, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Tells if a change to a node, its path normalized, breaks a lease: one
+ * on the node or under it, or on the metadata of its parent
+ */
+static int leaseBrokenBy(leaseEntry *lease, char *path){
+    int len = strlen(path);
+    char *slash = strrchr(path, '/');
+
+    if (!strncmp(lease->path, path, len) && (lease->path[len] == '\0' || lease->path[len] == '/'))
+        return 1;
+
+    len = slash ? slash - path : 0;
+    return (lease->kinds & LEASE_STAT) && strlen(lease->path) == len && !strncmp(lease->path, path, len);
+}
+
+/*
+ * Tells a client its lease was revoked, trying again while its socket is
+ * full until the lease runs out on its own.
+ */
+static void sendRevocation(leaseEntry *lease){
+    char message[sizeof(int) + 1 + MAX_FILE_NAME];
+    int marker = TECNICOFS_EVENT, size;
+
+    memcpy(message, &marker, sizeof(int));
+    message[sizeof(int)] = 'v';
+    strcpy(message + sizeof(int) + 1, lease->path);
+    size = sizeof(int) + 1 + strlen(lease->path) + 1;
+
+    while (sendto(sock, message, size, MSG_DONTWAIT, (struct sockaddr *) &lease->client, lease->clientLen) < 0) {
+        /* the client is gone, and its cache with it */
+        if (errno == ECONNREFUSED || errno == ENOENT)
+            return;
+
+        if (statsNow() >= lease->expiry) {
+            __atomic_fetch_add(&late, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        usleep(LEASE_RETRY_US);
+    }
+    __atomic_fetch_add(&revoked, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Sets the socket the revocations are sent from.
+ * Input:
+ *  - sockfd: the socket of the server
+ */
+void leaseInit(int sockfd){
+    sock = sockfd;
+}
+
+/*
+ * Lets a client cache what it is about to be told about a path. Must be
+ * called before looking the path up, so a change made meanwhile revokes it.
+ * Input:
+ *  - path: path of the node
+ *  - kinds: LEASE_LOOKUP, and LEASE_STAT for its metadata
+ *  - client: address the revocations are sent to
+ *  - clientLen: size of the address
+ * Returns: how long the lease lasts in ms, 0 if there are too many leases
+ */
+int leaseGrant(char *path, int kinds, struct sockaddr_un *client, socklen_t clientLen){
+    char normalized[MAX_FILE_NAME];
+    long long now = statsNow();
+    leaseEntry *free = NULL;
+
+    watchNormalizePath(normalized, path);
+    leaseLockMutex();
+
+    for (int i = 0; i < LEASE_MAX; i++) {
+        leaseEntry *lease = &leases[i];
+
+        if (lease->inUse && lease->expiry <= now) {
+            leaseFree(lease);
+            expired++;
+        }
+        if (!lease->inUse) {
+            if (free == NULL)
+                free = lease;
+        } else if (!strcmp(lease->path, normalized) && !strcmp(lease->client.sun_path, client->sun_path)) {
+            lease->kinds |= kinds;
+            lease->expiry = now + LEASE_DURATION_MS * 1000000LL;
+            renewed++;
+            leaseUnlockMutex();
+            return LEASE_DURATION_MS;
+        }
+    }
+
+    if (free == NULL) {
+        refused++;
+        leaseUnlockMutex();
+        return 0;
+    }
+
+    strcpy(free->path, normalized);
+    free->kinds = kinds;
+    free->client = *client;
+    free->clientLen = clientLen;
+    free->expiry = now + LEASE_DURATION_MS * 1000000LL;
+    free->inUse = 1;
+    __atomic_fetch_add(&held, 1, __ATOMIC_SEQ_CST);
+    granted++;
+
+    leaseUnlockMutex();
+    return LEASE_DURATION_MS;
+}
+
+/*
+ * Revokes the leases broken by a change to a node, once it is made and
+ * before it is answered, so no client answers from its cache what the
+ * change made stale after that. Called with no i-node locked, as it may
+ * wait for a client that isn't reading its events.
+ * Input:
+ *  - path: path of the node changed
+ */
+void leaseRevoke(char *path){
+    char normalized[MAX_FILE_NAME];
+    leaseEntry broken[LEASE_MAX];
+    long long now;
+    int count = 0;
+
+    /* a lease granted before the change was made must be seen here, even
+       when the lookup it was granted for took no lock */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&held, __ATOMIC_RELAXED) == 0)
+        return;
+
+    watchNormalizePath(normalized, path);
+    now = statsNow();
+    leaseLockMutex();
+
+    for (int i = 0; i < LEASE_MAX; i++) {
+        leaseEntry *lease = &leases[i];
+
+        if (!lease->inUse || !leaseBrokenBy(lease, normalized))
+            continue;
+
+        if (lease->expiry > now)
+            broken[count++] = *lease;
+        else
+            expired++;
+        leaseFree(lease);
+    }
+
+    leaseUnlockMutex();
+
+    /* a client slow to read doesn't hold up the other leases */
+    for (int i = 0; i < count; i++)
+        sendRevocation(&broken[i]);
+}
+
+/*
+ * Prints the leases granted and revoked.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void leasePrint(FILE *fp){
+    leaseLockMutex();
+
+    fprintf(fp, "# leases\n");
+    fprintf(fp, "held=%d granted=%lu renewed=%lu refused=%lu (table full) revoked=%lu expired=%lu late=%lu (client socket full until it ran out)\n",
+            __atomic_load_n(&held, __ATOMIC_RELAXED), granted, renewed, refused,
+            __atomic_load_n(&revoked, __ATOMIC_RELAXED), expired, __atomic_load_n(&late, __ATOMIC_RELAXED));
+
+    leaseUnlockMutex();
+}
@@ -0,0 +1,26 @@
+#ifndef LEASE_H
+#define LEASE_H
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../tecnicofs-api-constants.h"
+
+/* Leases held at the same time, over all clients */
+#define LEASE_MAX 128
+/* How long a client may answer from its cache without asking again */
+#define LEASE_DURATION_MS 2000
+/* How long to wait before sending a revocation again to a full socket */
+#define LEASE_RETRY_US 200
+
+/* What a lease covers: the node (lookup), or its metadata too (stat),
+   which changes with its children */
+#define LEASE_LOOKUP 1
+#define LEASE_STAT 2
+
+void leaseInit(int sockfd);
+int leaseGrant(char *path, int kinds, struct sockaddr_un *client, socklen_t clientLen);
+void leaseRevoke(char *path);
+void leasePrint(FILE *fp);
+
+#endif
@@ -0,0 +1,441 @@
+#include "watch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../er/error.h"
+#include "../fs/state.h"
+
+/*
+ * A change waiting to be pushed. The ring has many producers (the
+ * threads changing the tree) and a single consumer (the push thread):
+ * a producer claims a slot by moving head, and seq tells the consumer
+ * when the slot is filled and the producers when it is free again.
+ */
+typedef struct watchEventSlot {
+    unsigned long seq;
+    char op;
+    char path[MAX_FILE_NAME];
+    char dest[MAX_FILE_NAME];
+} watchEventSlot;
+
+/*
+ * A directory watched by a client
+ */
+typedef struct watchEntry {
+    int inUse;
+    char path[MAX_FILE_NAME];
+    int recursive;
+    struct sockaddr_un client;
+    socklen_t clientLen;
+    unsigned long pushed;
+    unsigned long lost;
+    /* events were lost since the client was last told so */
+    int overflowed;
+} watchEntry;
+
+static watchEventSlot ring[WATCH_RING_SIZE];
+static unsigned long head = 0;
+static unsigned long tail = 0;
+static unsigned long dropped = 0;
+/* dropped when the push thread last marked the watches, and if some
+   watch may still be owed an o event (both only used by the push thread) */
+static unsigned long droppedSeen = 0;
+static int overflowsOwed = 0;
+
+/* watches are changed and read with watchLock held, watchers is read without */
+static pthread_mutex_t watchLock = PTHREAD_MUTEX_INITIALIZER;
+static watchEntry watches[WATCH_MAX];
+static int watchers = 0;
+
+static int sock = -1;
+static int stopping = 0;
+static int started = 0;
+static pthread_t pushThread;
+static unsigned long events = 0;
+
+static void watchLockMutex(){
+    if (pthread_mutex_lock(&watchLock))
+        errorParse("Error while locking the watches\n");
+}
+
+static void watchUnlockMutex(){
+    if (pthread_mutex_unlock(&watchLock))
+        errorParse("Error while unlocking the watches\n");
+}
+
+/*
+ * Writes a path as /a/b, whatever its slashes, the root being "".
+ * Input:
+ *  - normalized: stores the path, at least MAX_FILE_NAME long
+ *  - path: the path
+ */
+void watchNormalizePath(char *normalized, const char *path){
+    int len = 0;
+
+    for (const char *c = path; *c && len < MAX_FILE_NAME - 2; c++) {
+        if (*c == '/' && (len == 0 || normalized[len - 1] == '/'))
+            continue;
+        if (len == 0)
+            normalized[len++] = '/';
+        normalized[len++] = *c;
+    }
+    if (len > 0 && normalized[len - 1] == '/')
+        len--;
+    normalized[len] = '\0';
+}
+
+/* Tells if a watch sees a change to a node, both paths normalized */
+static int watchSees(watchEntry *watch, char *path){
+    int len = strlen(watch->path);
+    char *slash;
+
+    if (strncmp(path, watch->path, len) != 0 || path[len] != '/')
+        return 0;
+    if (watch->recursive)
+        return 1;
+
+    /* only the children of the directory */
+    slash = strchr(path + len + 1, '/');
+    return slash == NULL;
+}
+
+static int sameClient(watchEntry *watch, struct sockaddr_un *client){
+    return !strcmp(watch->client.sun_path, client->sun_path);
+}
+
+/* Tells if a watch sees an event */
+static int watchSeesEvent(watchEntry *watch, watchEventSlot *event){
+    return watch->inUse && (watchSees(watch, event->path) || (event->op == 'm' && watchSees(watch, event->dest)));
+}
+
+/*
+ * Writes an event as sent to the clients.
+ * Returns: its size
+ */
+static int formatEvent(char *message, char op, char *path, char *dest){
+    int marker = TECNICOFS_EVENT, size;
+
+    memcpy(message, &marker, sizeof(int));
+    message[sizeof(int)] = op;
+    size = sizeof(int) + 1;
+    strcpy(message + size, path);
+    size += strlen(path) + 1;
+    if (op == 'm') {
+        strcpy(message + size, dest);
+        size += strlen(dest) + 1;
+    }
+    return size;
+}
+
+/*
+ * Sends the o event owed to a client that missed events, with the path
+ * watched, telling it to read the directory again. Without waiting, it
+ * stays owed if it can't be sent now.
+ */
+static void sendOverflow(watchEntry *watch){
+    char overflow[sizeof(int) + 1 + 2 * MAX_FILE_NAME];
+    int overflowSize = formatEvent(overflow, 'o', *watch->path ? watch->path : "/", NULL);
+
+    if (sendto(sock, overflow, overflowSize, MSG_DONTWAIT, (struct sockaddr *) &watch->client, watch->clientLen) >= 0)
+        watch->overflowed = 0;
+}
+
+/*
+ * Sends an event to a client without waiting. A client that missed events
+ * is first sent an o event (see sendOverflow).
+ * Returns: SUCCESS, or FAIL if the client is gone
+ */
+static int sendEvent(watchEntry *watch, char *message, int size){
+    int sent;
+
+    if (watch->overflowed)
+        sendOverflow(watch);
+
+    sent = !watch->overflowed &&
+            sendto(sock, message, size, MSG_DONTWAIT, (struct sockaddr *) &watch->client, watch->clientLen) >= 0;
+
+    if (sent) {
+        watch->pushed++;
+        return SUCCESS;
+    }
+    if (errno == ECONNREFUSED || errno == ENOENT)
+        return FAIL;
+
+    watch->lost++;
+    watch->overflowed = 1;
+    overflowsOwed = 1;
+    return SUCCESS;
+}
+
+/*
+ * Marks every watch as having missed events when the ring dropped some
+ * since the last call (who would have seen them isn't known), and sends
+ * the o events owed to watches that may get no other event for a while.
+ */
+static void pushOverflows(){
+    unsigned long lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+
+    if (lost == droppedSeen && !overflowsOwed)
+        return;
+
+    watchLockMutex();
+    overflowsOwed = 0;
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchEntry *watch = &watches[i];
+
+        if (!watch->inUse)
+            continue;
+        if (lost != droppedSeen)
+            watch->overflowed = 1;
+        if (watch->overflowed)
+            sendOverflow(watch);
+        if (watch->overflowed)
+            overflowsOwed = 1;
+    }
+    droppedSeen = lost;
+    watchUnlockMutex();
+}
+
+/*
+ * Sends an event to every client watching it, once per client even when
+ * several of its watches see it, with watchLock held. Clients that are
+ * gone lose their watches.
+ */
+static void pushEvent(watchEventSlot *event){
+    char message[sizeof(int) + 1 + 2 * MAX_FILE_NAME];
+    int size = formatEvent(message, event->op, event->path, event->dest);
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchEntry *watch = &watches[i];
+        int seen = 0;
+
+        if (!watchSeesEvent(watch, event))
+            continue;
+        for (int j = 0; j < i && !seen; j++)
+            seen = watchSeesEvent(&watches[j], event) && sameClient(&watches[j], &watch->client);
+        if (seen)
+            continue;
+
+        /* never wait for a client that doesn't read its events */
+        if (sendEvent(watch, message, size) == FAIL) {
+            watch->inUse = 0;
+            __atomic_fetch_sub(&watchers, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Pushes every event in the ring.
+ * Returns: number of events pushed
+ */
+static int drainEvents(){
+    int pushed = 0;
+
+    while (1) {
+        watchEventSlot *event = &ring[tail & (WATCH_RING_SIZE - 1)];
+
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+
+        watchLockMutex();
+        pushEvent(event);
+        watchUnlockMutex();
+
+        __atomic_store_n(&event->seq, tail + WATCH_RING_SIZE, __ATOMIC_RELEASE);
+        tail++;
+        pushed++;
+    }
+
+    return pushed;
+}
+
+static void *pushLoop(void *arg){
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        pushOverflows();
+        if (drainEvents() == 0)
+            usleep(WATCH_DRAIN_PERIOD_US);
+    }
+    pushOverflows();
+    drainEvents();
+
+    return NULL;
+}
+
+
+/*
+ * Starts the thread that pushes the events to the clients watching them.
+ * Input:
+ *  - sockfd: the socket of the server
+ */
+void watchInit(int sockfd){
+    sock = sockfd;
+
+    for (int i = 0; i < WATCH_RING_SIZE; i++)
+        ring[i].seq = i;
+
+    if (pthread_create(&pushThread, NULL, pushLoop, NULL) != 0)
+        errorParse("Error while creating the watch thread.\n");
+    started = 1;
+}
+
+/*
+ * Pushes the pending events and stops the push thread.
+ */
+void watchDestroy(){
+    if (!started)
+        return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    if (pthread_join(pushThread, NULL))
+        errorParse("Error while joining the watch thread\n");
+    started = 0;
+}
+
+/*
+ * Makes a client get the changes to the children of a directory, or to
+ * everything under it. Watching it again only changes recursive.
+ * Input:
+ *  - path: path of the directory
+ *  - recursive: everything under it, not only its children
+ *  - client: address the events are sent to
+ *  - clientLen: size of the address
+ * Returns: SUCCESS or FAIL if there are too many watches
+ */
+int watchSubscribe(char *path, int recursive, struct sockaddr_un *client, socklen_t clientLen){
+    char normalized[MAX_FILE_NAME];
+    watchEntry *free = NULL;
+
+    watchNormalizePath(normalized, path);
+    watchLockMutex();
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchEntry *watch = &watches[i];
+
+        if (!watch->inUse) {
+            if (free == NULL)
+                free = watch;
+        } else if (sameClient(watch, client) && !strcmp(watch->path, normalized)) {
+            watch->recursive = recursive;
+            watchUnlockMutex();
+            return SUCCESS;
+        }
+    }
+
+    if (free == NULL) {
+        watchUnlockMutex();
+        return FAIL;
+    }
+
+    strcpy(free->path, normalized);
+    free->recursive = recursive;
+    free->client = *client;
+    free->clientLen = clientLen;
+    free->pushed = 0;
+    free->lost = 0;
+    free->overflowed = 0;
+    free->inUse = 1;
+    __atomic_fetch_add(&watchers, 1, __ATOMIC_RELAXED);
+
+    watchUnlockMutex();
+    return SUCCESS;
+}
+
+/*
+ * Stops a client watching a directory.
+ * Input:
+ *  - path: path of the directory
+ *  - client: address of the client
+ *  - clientLen: size of the address
+ * Returns: SUCCESS or FAIL if it wasn't watching it
+ */
+int watchUnsubscribe(char *path, struct sockaddr_un *client, socklen_t clientLen){
+    char normalized[MAX_FILE_NAME];
+    int result = FAIL;
+
+    watchNormalizePath(normalized, path);
+    watchLockMutex();
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchEntry *watch = &watches[i];
+
+        if (watch->inUse && sameClient(watch, client) && !strcmp(watch->path, normalized)) {
+            watch->inUse = 0;
+            __atomic_fetch_sub(&watchers, 1, __ATOMIC_RELAXED);
+            result = SUCCESS;
+        }
+    }
+
+    watchUnlockMutex();
+    return result;
+}
+
+/*
+ * Records a change to the tree without blocking, for the push thread to
+ * send to the clients watching it. Nothing is recorded while nobody
+ * watches, and events are dropped (and counted) while the ring is full,
+ * every watch then being sent an o event (see pushOverflows).
+ * Called while the node is still locked, so the events of a node are in
+ * the order of its changes.
+ * Input:
+ *  - op: the command that changed it (c, d, m or u)
+ *  - path: path of the node
+ *  - dest: path it was moved to, for m
+ */
+void watchEvent(char op, char *path, char *dest){
+    unsigned long pos;
+    watchEventSlot *event;
+
+    if (__atomic_load_n(&watchers, __ATOMIC_RELAXED) == 0)
+        return;
+
+    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    while (1) {
+        long diff;
+
+        event = &ring[pos & (WATCH_RING_SIZE - 1)];
+        diff = (long) (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0 && __atomic_compare_exchange_n(&head, &pos, pos + 1,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+        if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (diff > 0)
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+
+    event->op = op;
+    watchNormalizePath(event->path, path);
+    watchNormalizePath(event->dest, dest ? dest : "");
+    __atomic_fetch_add(&events, 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&event->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Prints the events recorded and dropped, and each watch.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void watchPrint(FILE *fp){
+    watchLockMutex();
+
+    fprintf(fp, "# watches\n");
+    fprintf(fp, "events=%lu dropped=%lu (ring full) watches=%d\n", __atomic_load_n(&events, __ATOMIC_RELAXED),
+            __atomic_load_n(&dropped, __ATOMIC_RELAXED), __atomic_load_n(&watchers, __ATOMIC_RELAXED));
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchEntry *watch = &watches[i];
+
+        if (watch->inUse)
+            fprintf(fp, "watch %s%s client %s pushed=%lu lost=%lu\n", *watch->path ? watch->path : "/",
+                    watch->recursive ? " (recursive)" : "", watch->client.sun_path, watch->pushed, watch->lost);
+    }
+
+    watchUnlockMutex();
+}
@@ -0,0 +1,24 @@
+#ifndef WT_H
+#define WT_H
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../tecnicofs-api-constants.h"
+
+/* Directories watched at the same time, over all clients */
+#define WATCH_MAX 64
+/* Events waiting to be pushed, must be a power of two */
+#define WATCH_RING_SIZE 256
+/* How long the push thread sleeps when there are no events */
+#define WATCH_DRAIN_PERIOD_US 2000
+
+void watchInit(int sockfd);
+void watchDestroy();
+int watchSubscribe(char *path, int recursive, struct sockaddr_un *client, socklen_t clientLen);
+int watchUnsubscribe(char *path, struct sockaddr_un *client, socklen_t clientLen);
+void watchEvent(char op, char *path, char *dest);
+void watchNormalizePath(char *normalized, const char *path);
+void watchPrint(FILE *fp);
+
+#endif